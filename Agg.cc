@@ -0,0 +1,283 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Aggregation of small messages into one RF frame.
+ *
+ * Requires Comm.cc module included (with COMM_TX and COMM_TXSG for sending).
+ * Each small record costs a frame overhead (synch, length, control, CRC
+ * and dummy byte) plus a TX mode switch. This module collects queued
+ * records in a staging buffer and sends them in one Comm frame once
+ * the buffer is full or the oldest record gets too old.
+ * Frame body looks like this:
+ * LEN1 DATA1 LEN2 DATA2 ... LENn DATAn
+ *
+ * Two staging buffers are used, so one can be filled while the other
+ * one is streamed by TXSend() - no copy into Comm TX buffer is done.
+ *
+ * TX Example:
+ * Agg::Put(Record, RecordLen, Now);	// Might send a frame
+ * Agg::Poll(Now);			// Periodically; flushes old records
+ *
+ * RX Example (see Testcase_TX/RX):
+ * Agg::iter_t It;
+ * if (!Agg::Begin(&It, Buff, Length))
+ *	HandleFrame(Buff, Length);	// Not aggregated
+ * while ((Rec = Agg::Next(&It, &RecLen)) != NULL)
+ *	Handle(Rec, RecLen);
+ *
+ * With the control byte compiled aggregated frames are marked with
+ * AGG_CONFIG; other frames keep the Config set with Comm::TXConfig(),
+ * so both kinds might be mixed on one link.
+ ********************/
+
+/***
+ * Aggregation configuration
+ ***/
+
+/* Size of one staging buffer - maximal aggregated frame body.
+ * Must not exceed the length which fits in Comm::len_t */
+#define AGG_MAXSIZE	64
+
+/* Flush when the oldest record is that old; in units of Now passed
+ * to Put()/Poll() (For e.g. ms) */
+#define AGG_MAXAGE	50
+
+/* Config nibble marking aggregated frames (if control byte is compiled) */
+#define AGG_CONFIG	0x0F
+
+/* Compile testcases (need Comm testcases and stdio on UART) */
+#define AGG_TESTCASES	COMM1_TESTCASES
+
+/** Aggregation of small messages */
+namespace Agg {
+	/** Record length type (sub-header) */
+	typedef uint8_t rlen_t;
+
+	/** Aggregation state */
+	static struct {
+		uint8_t Buff[2][AGG_MAXSIZE];
+		uint8_t Cur;		/* Buffer being filled */
+		uint8_t Used;		/* Bytes used in current buffer */
+		uint16_t First;		/* Time of the oldest queued record */
+#if COMM1_TXSG
+		Comm::segment_t Seg;	/* Frame description for TXSend */
+#endif
+	} State;
+
+#if COMM1_TXSG
+	/** Send whatever is queued; blocks only if the
+	 * previous aggregated frame is still being transmitted.
+	 * Returns 0 if there was nothing to send. */
+	static char Flush(void)
+	{
+		if (State.Used == 0)
+			return 0;
+
+		/* Segment describes the other buffer until TX finishes */
+		Comm::TXWait();
+		State.Seg.Data = State.Buff[State.Cur];
+		State.Seg.Length = State.Used;
+		State.Seg.Flags = Comm::SG_RAM;
+#if COMM1_CTR
+		Comm::TXSendConfig(&State.Seg, 1, AGG_CONFIG);
+#else
+		Comm::TXSend(&State.Seg, 1);
+#endif
+
+		/* Swap buffers */
+		State.Cur ^= 1;
+		State.Used = 0;
+		return 1;
+	}
+
+	/**
+	 * \brief
+	 *   Queue one record. If it doesn't fit into the current
+	 *   frame, the frame is sent first.
+	 *
+	 * \param Data
+	 *   Record data, copied into staging buffer.
+	 * \param Length
+	 *   Record length; 1 to AGG_MAXSIZE - sizeof(rlen_t)
+	 * \param Now
+	 *   Current time, used for age limit.
+	 *
+	 * \return 0 if the record is too long to be aggregated.
+	 */
+	static char Put(const void *Data, rlen_t Length, uint16_t Now)
+	{
+		uint8_t *Pos;
+		if (Length == 0 || Length > AGG_MAXSIZE - sizeof(rlen_t))
+			return 0;
+
+		if (State.Used + sizeof(rlen_t) + Length > AGG_MAXSIZE)
+			Flush();
+
+		if (State.Used == 0)
+			State.First = Now;
+
+		Pos = State.Buff[State.Cur] + State.Used;
+		*Pos = Length;
+		memcpy(Pos + sizeof(rlen_t), Data, Length);
+		State.Used += sizeof(rlen_t) + Length;
+
+		/* Full - no other record would fit */
+		if (State.Used + sizeof(rlen_t) >= AGG_MAXSIZE)
+			Flush();
+		return 1;
+	}
+
+	/** Call periodically; flushes records older than AGG_MAXAGE */
+	static inline void Poll(uint16_t Now)
+	{
+		if (State.Used && (uint16_t)(Now - State.First) >= AGG_MAXAGE)
+			Flush();
+	}
+#endif /* TXSG */
+
+	/** De-aggregation iterator */
+	typedef struct {
+		const uint8_t *Cur, *End;
+	} iter_t;
+
+	/** Start iterating; Next() returns NULL at once unless Aggregated */
+	static inline char Start(iter_t *It, const void *Buff, Comm::len_t Length,
+				 char Aggregated)
+	{
+		It->Cur = (const uint8_t *)Buff;
+		It->End = Aggregated ? It->Cur + Length : It->Cur;
+		return Aggregated;
+	}
+
+#if COMM1_RX && !COMM1_RXPOOL
+	/** Start iterating over records in the received frame body.
+	 * Returns 0 (and Next() returns NULL) if the frame isn't marked
+	 * as aggregated; without the control byte each frame is taken
+	 * as aggregated. */
+	static inline char Begin(iter_t *It, const void *Buff, Comm::len_t Length)
+	{
+#if COMM1_CTR
+		return Start(It, Buff, Length, Comm::RXGetConfig() == AGG_CONFIG);
+#else
+		return Start(It, Buff, Length, 1);
+#endif
+	}
+#endif /* RX */
+
+#if COMM1_RXPOOL
+	/** Begin() for a packet taken with Comm::RXTake() */
+	static inline char Begin(iter_t *It, const Comm::packet_t *Pkt,
+				 Comm::len_t Length)
+	{
+#if COMM1_CTR
+		return Start(It, Pkt->Mesg, Length, Pkt->Type.C.Config == AGG_CONFIG);
+#else
+		return Start(It, Pkt->Mesg, Length, 1);
+#endif
+	}
+#endif /* RXPOOL */
+
+	/** Return next record and its length; NULL at the end of frame
+	 * or if the frame is malformed. */
+	static inline const char *Next(iter_t *It, rlen_t *Length)
+	{
+		const uint8_t *Rec;
+		if (It->Cur + sizeof(rlen_t) > It->End)
+			return NULL;
+		*Length = *It->Cur;
+		Rec = It->Cur + sizeof(rlen_t);
+		if (*Length == 0 || Rec + *Length > It->End) {
+			It->Cur = It->End;
+			return NULL;
+		}
+		It->Cur = Rec + *Length;
+		return (const char *)Rec;
+	}
+
+#if AGG_TESTCASES
+	/** Config of plain testcase frames */
+	const uint8_t TestConfig = 0x03;
+
+#if COMM1_TXSG
+	/** Queue numbered records and send a plain frame between them
+	 * now and then; both kinds go out interleaved */
+	static inline void Testcase_TX(void)
+	{
+		static char Plain[16];
+		Comm::segment_t Seg;
+		char Rec[8];
+		uint16_t Now = 0;
+		uint16_t i;
+
+		Comm::Init();
+		sei();
+#if COMM1_CTR
+		Comm::TXConfig(TestConfig);
+#endif
+		for (i = 0; ; i++) {
+			Put(Rec, sprintf(Rec, "R%u", i), Now);
+			if (i % 8 == 7) {
+				/* Plain frame; the other buffer might be on air */
+				Comm::TXWait();
+				Seg.Data = Plain;
+				Seg.Length = sprintf(Plain, "P%u", i);
+				Seg.Flags = Comm::SG_RAM;
+				Comm::TXSend(&Seg, 1);
+				Comm::TXWait();
+#if COMM1_CTR
+				if (Comm::TXGetConfig() != TestConfig)
+					printf("AGG: config not restored\n");
+#endif
+			}
+			_delay_ms(5);
+			Now += 5;
+			Poll(Now);
+		}
+	}
+#endif /* TXSG */
+
+#if COMM1_RX && !COMM1_RXPOOL
+	/** Receive frames from Testcase_TX; counts records of aggregated
+	 * frames and plain frames, which must carry TestConfig */
+	static inline void Testcase_RX(void)
+	{
+		uint16_t Frames = 0, Records = 0, Plain = 0, Bad = 0;
+		const char *Buff, *Rec;
+		Comm::len_t Length;
+		rlen_t RecLen;
+		iter_t It;
+
+		Comm::Init();
+		sei();
+		for (;;) {
+			Comm::RXInit();
+			Comm::RXWait();
+			Buff = Comm::RXGetPacket(&Length);
+			if (!Length)
+				continue;
+			if (Begin(&It, Buff, Length)) {
+				Frames++;
+				while ((Rec = Next(&It, &RecLen)) != NULL) {
+					Records++;
+					if (*Rec != 'R')
+						Bad++;
+				}
+			} else {
+				/* Config of the last aggregated frame must
+				 * not stick to plain ones */
+				Plain++;
+				if (Buff[0] != 'P')
+					Bad++;
+#if COMM1_CTR
+				if (Comm::RXGetConfig() != TestConfig)
+					Bad++;
+#endif
+			}
+			printf("AGG: %u frames (%u records), plain %u, bad %u\n",
+			       Frames, Records, Plain, Bad);
+		}
+	}
+#endif /* RX */
+#endif /* TESTCASES */
+}
@@ -0,0 +1,163 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Transparent serial-to-radio bridge.
+ *
+ * Requires Comm.cc module included (RX without RXPOOL, TX with TXSG).
+ * UART is serviced by interrupts only: received bytes go into the input
+ * ring, output ring is drained by the data register empty interrupt.
+ * Poll() called from the main loop moves input bytes into one of two
+ * staging buffers and sends it when it's full or when no byte came for
+ * BRIDGE_GAP ticks; the other buffer is filled meanwhile, as TXSend()
+ * streams straight from the staging buffer. Between transmissions
+ * the receiver listens; received frames are copied into the output
+ * ring and receiving is restarted at once. Nothing blocks, so bytes
+ * aren't lost as long as the input ring covers one frame time.
+ *
+ * UART must be configured by the application (baud rate, RX/TX on,
+ * RX complete interrupt enabled).
+ *
+ * Example:
+ * Comm::Init(); UART init; sei();
+ * for (;;) Bridge::Poll();
+ ********************/
+
+/***
+ * Bridge configuration
+ ***/
+
+/* Ring sizes (power of 2, max 128) */
+#define BRIDGE_IN	128
+#define BRIDGE_OUT	128
+
+/* Largest frame body */
+#define BRIDGE_FRAME	64
+
+/* Flush when no byte came for that long [COMM_TICK ticks]
+ * (For e.g. 2ms - a few characters at 9600 baud) */
+#define BRIDGE_GAP	2000
+
+/* UART hardware */
+#define BRIDGE_UDR		UDR0
+#define BRIDGE_UCSRB		UCSR0B
+#define BRIDGE_UDRIE		UDRIE0
+#define BRIDGE_RX_vect		USART0_RX_vect
+#define BRIDGE_UDRE_vect	USART0_UDRE_vect
+
+/** Serial-to-radio bridge */
+namespace Bridge {
+	/** Bridge state */
+	static struct {
+		/* UART rings; heads written by producers, tails by consumers */
+		uint8_t In[BRIDGE_IN];
+		volatile uint8_t InHead, InTail;
+		uint8_t Out[BRIDGE_OUT];
+		volatile uint8_t OutHead, OutTail;
+		volatile uint16_t LastByte;	/* Tick of last input byte */
+
+		/* Staging buffers */
+		uint8_t Buff[2][BRIDGE_FRAME];
+		uint8_t Cur;		/* Buffer being filled */
+		uint8_t Used;
+		Comm::segment_t Seg;
+
+		/* Statistics */
+		uint16_t InLost;	/* Input bytes dropped (ring full) */
+		uint32_t Frames;
+	} State;
+
+	/** UART byte received */
+	ISR(BRIDGE_RX_vect)
+	{
+		const uint8_t Byte = BRIDGE_UDR;
+		if ((uint8_t)(State.InHead - State.InTail) >= BRIDGE_IN) {
+			State.InLost++;
+			return;
+		}
+		State.In[State.InHead & (BRIDGE_IN - 1)] = Byte;
+		State.InHead++;
+		State.LastByte = Comm::Tick();
+	}
+
+	/** UART ready for next byte */
+	ISR(BRIDGE_UDRE_vect)
+	{
+		if (State.OutHead == State.OutTail) {
+			BRIDGE_UCSRB &= ~(1<<BRIDGE_UDRIE);
+			return;
+		}
+		BRIDGE_UDR = State.Out[State.OutTail & (BRIDGE_OUT - 1)];
+		State.OutTail++;
+	}
+
+	/** Send current staging buffer and swap */
+	static inline void Flush(void)
+	{
+		State.Seg.Data = State.Buff[State.Cur];
+		State.Seg.Length = State.Used;
+		State.Seg.Flags = Comm::SG_RAM;
+		Comm::TXSend(&State.Seg, 1);
+		State.Frames++;
+		State.Cur ^= 1;
+		State.Used = 0;
+	}
+
+	/** Move received frame into output ring; returns 0 if
+	 * there's no space yet */
+	static inline char Output(void)
+	{
+		Comm::len_t Length, i;
+		const char *Buff = Comm::RXGetPacket(&Length);
+		if (Length > BRIDGE_OUT)
+			return 1; /* Would never fit; drop */
+		if ((uint8_t)(BRIDGE_OUT - (uint8_t)(State.OutHead - State.OutTail)) < Length)
+			return 0;
+		for (i = 0; i < Length; i++)
+			State.Out[(uint8_t)(State.OutHead + i) & (BRIDGE_OUT - 1)] = Buff[i];
+		State.OutHead += Length;
+		BRIDGE_UCSRB |= 1<<BRIDGE_UDRIE;
+		return 1;
+	}
+
+	/** Bridge work; call from the main loop as often as possible */
+	static void Poll(void)
+	{
+		const uint8_t Mode = Comm::State.Mode;
+		Comm::len_t Length;
+		uint8_t Head, SReg;
+		uint16_t Last;
+
+		/* Input ring -> staging buffer */
+		Head = State.InHead;
+		while (State.InTail != Head && State.Used < BRIDGE_FRAME) {
+			State.Buff[State.Cur][State.Used++] =
+				State.In[State.InTail & (BRIDGE_IN - 1)];
+			State.InTail++;
+		}
+
+		/* Received frame -> output ring */
+		if (Mode == Comm::MX) {
+			if (!Output())
+				return;
+			Comm::RXInit();
+			return;
+		}
+
+		/* Radio busy: frame on air or being received */
+		if (Mode == Comm::MT || Mode == Comm::MR ||
+		    (Mode == Comm::Mr && Comm::RXGetCount(&Length)))
+			return;
+
+		SReg = SREG;
+		cli();
+		Last = State.LastByte;
+		SREG = SReg;
+		if (State.Used == BRIDGE_FRAME ||
+		    (State.Used && State.InTail == State.InHead &&
+		     (uint16_t)(Comm::Tick() - Last) >= BRIDGE_GAP))
+			Flush();
+		else if (Mode != Comm::Mr)
+			Comm::RXInit();
+	}
+}
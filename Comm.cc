@@ -10,7 +10,7 @@
  * It sends packets containing up to 256 bytes of data (might be changed).
  * Each packet contains data length, control byte and CRC and is
  * encapsulated in a frame starting with synchronization bytes for RFM
- * Final frame looks like this:
+ * Final frame looks like this (see Frame.h, shared with host tools):
  * AA AA 2D D4 LENGTH, CONTROL, DATA, CRC
  *
  * TX/RX/CRC/Control byte might be freely compiled-in or not.
@@ -24,24 +24,51 @@
  * Comm::TXInit(Length);
  * Comm::TXWait();
  *
+ * Scatter/gather TX Example (no copying; list must live until TXWait()):
+ * Comm::segment_t Seg[2] = {{Head, HeadLen, Comm::SG_RAM},
+ *                           {Body, BodyLen, Comm::SG_PGM}};
+ * Comm::TXSend(Seg, 2);
+ * Comm::TXWait();
+ *
  * RX Example:
  * char *Buff; Comm::len_t Length;
  * Comm::RXInit();
  * Comm::RXWait(); // Block until something is read (Lookout for RXRETRY option) 
  * Buff = Comm::RXGetPacket(&Length);
+ *
+ * RX into own buffers (COMM_RXPOOL):
+ * Comm::RXGive(&MyPacket1); Comm::RXGive(&MyPacket2);
+ * Comm::RXInit();
+ * Comm::RXWait();
+ * Comm::packet_t *Pkt = Comm::RXTake(&Length); // Ours again; RXGive() it back later
  ********************/
 
 /***
  * Comm functionality configuration
+ *
+ * Each option might be set by the includer instead. Options are
+ * #undef'd at the end of this file, so an instance included again
+ * (see below) gets the defaults besides the options defined for it;
+ * every instance gets an interrupt handler with only its features
+ * compiled in. Feature switches of the primary (first) instance stay
+ * available as COMM1_* (COMM1_TX, COMM1_CTR, ...) for modules using
+ * Comm (Agg.cc, Tune.cc, ...). Host/comm_matrix.sh builds this file
+ * with many option combinations.
  ***/
 
 /* Enable transmitter functions */
-#define COMM_TX		1
+#ifndef COMM_TX
+#	define COMM_TX	1
+#endif
 /* Enable receiver functions */
-#define COMM_RX		1
+#ifndef COMM_RX
+#	define COMM_RX	1
+#endif
 
 /* Use CRC16 CCITT to maintain data integrity */
-#define COMM_CRC	1
+#ifndef COMM_CRC
+#	define COMM_CRC	1
+#endif
 
 /* Control byte
  *
@@ -51,10 +78,94 @@
  * Control byte has 4 bits free to use, and 4 duplicating
  * the length field.
  */
-#define COMM_CTR	1
+#ifndef COMM_CTR
+#	define COMM_CTR	1
+#endif
+
+/* Scatter/gather TX: TXSend() streams a frame straight from a list of RAM
+ * or PROGMEM segments. CRC is calculated on the fly in the interrupt,
+ * so nothing is copied into the TX buffer. */
+#ifndef COMM_TXSG
+#	define COMM_TXSG	1
+#endif
+
+/* Compile in the TX buffer used by TXGetBuff()/TXInit(). Might be turned off
+ * when only TXSend() is used - saves MaxMesgSize + 9 bytes of RAM. */
+#ifndef COMM_TXBUFF
+#	define COMM_TXBUFF	1
+#endif
+
+/* Half-duplex shared buffer: receive into the packet part of the TX
+ * buffer instead of a separate RX buffer. Saves sizeof(packet_t) bytes.
+ * Received packet is lost when the next one is prepared in TXGetBuff(),
+ * and TX buffer can't be filled while receiving. Requires TXBUFF. */
+#ifndef COMM_SHARED
+#	define COMM_SHARED	0
+#endif
+
+/* Sender id and sequence number in the packet header. Receiver keeps
+ * a window of recently received sequence numbers for COMM_SEQ_SOURCES
+ * senders and drops repeated frames (TX retries, application retries
+ * with TXRepeat()) right after the header - body isn't even buffered. */
+#ifndef COMM_SEQ
+#	define COMM_SEQ	0
+#endif
+#ifndef COMM_SEQ_SOURCES
+#	define COMM_SEQ_SOURCES	4
+#endif
+
+/* Authenticated encryption (Speck64/128 in counter mode + CBC-MAC)
+ * done byte by byte in the interrupt, next to the CRC update. Header
+ * carries a 32 bit nonce, body is encrypted, a 32 bit tag follows it.
+ * The tag covers the whole header (length, control byte with Config,
+ * Src/Seq and nonce) and the body.
+ * Cipher blocks are computed ahead, COMM_CIPHER_ROUNDS rounds per byte
+ * interrupt (~45 cycles per round, so ~350 cycles/byte on AVR at 7).
+ * Two bursts of up to 54 rounds happen per frame: at the nonce (RX)
+ * and at the tag (both) - a byte time must cover them (For e.g. 20kbps
+ * at 8MHz, 50kbps at 16MHz). TX requires TXSG; TXInit() streams the
+ * TX buffer through it. Set key with CipherKey().
+ * A nonce must never repeat with the same key, also across reboots, so
+ * TX is refused (TXInit()/TXSend() return 0) until the nonce is set: by CipherNonceLoad() from EEPROM
+ * (blocks of COMM_CIPHER_RESERVE nonces are reserved there ahead, so
+ * a reset skips at most one block) or by CipherNonce() if the
+ * application keeps it elsewhere.
+ * Receiver rejects frames with a nonce not above the last accepted one
+ * of the same sender (replays). Senders are told apart by COMM_SEQ
+ * source id, checked after the tag so a forged id can't touch the
+ * state of real senders (without it there must be only one sender per
+ * receiver);
+ * COMM_CIPHER_PEERS of them are remembered - it should cover all. */
+#ifndef COMM_CIPHER
+#	define COMM_CIPHER	0
+#endif
+#ifndef COMM_CIPHER_ROUNDS
+#	define COMM_CIPHER_ROUNDS	7
+#endif
+#ifndef COMM_CIPHER_RESERVE
+#	define COMM_CIPHER_RESERVE	256
+#endif
+#ifndef COMM_CIPHER_PEERS
+#	define COMM_CIPHER_PEERS	4
+#endif
 
 /* Shall we retry TX on buffer underrun? Not well tested - beware. */
-#define COMM_TXRETRY	1
+#ifndef COMM_TXRETRY
+#	define COMM_TXRETRY	1
+#endif
+
+/* Receive into application-owned buffers. Application gives buffers
+ * with RXGive(), the interrupt receives directly into them and returns
+ * filled ones through RXTake(). Receiving continues as long as free
+ * buffers are available. Replaces the static RX buffer. */
+#ifndef COMM_RXPOOL
+#	define COMM_RXPOOL	0
+#endif
+
+/* Number of buffers the pool may hold (power of 2) */
+#ifndef COMM_RXQUEUE
+#	define COMM_RXQUEUE	4
+#endif
 
 /* Shall we listen for another frame after we failed to correctly receive one?
  * After the RFM sees synchronization pattern (2D D4) it starts to send data to us.
@@ -64,25 +175,189 @@
  * (But there's still probability that length field will be incorrect - say equal 
  * to 0)
  */
-#define COMM_RXRETRY	1
+#ifndef COMM_RXRETRY
+#	define COMM_RXRETRY	1
+#endif
+
+/* Store reception quality (RSSI, DQD, AFC offset from the status word)
+ * with each received packet. Costs a few cycles per received byte. */
+#ifndef COMM_QUALITY
+#	define COMM_QUALITY	1
+#endif
 
 /* Enable statistics for either RX, TX or both */
-#define COMM_STATS_TX	1
-#define COMM_STATS_RX	1
+#ifndef COMM_STATS_TX
+#	define COMM_STATS_TX	1
+#endif
+#ifndef COMM_STATS_RX
+#	define COMM_STATS_RX	1
+#endif
+
+/* Histograms of received packet size and of time from synchronization
+ * to the end of frame in byte times at the current rate (requires
+ * COMM_TICK timer running; about 10 cycles more per byte) */
+#ifndef COMM_STATS_HIST
+#	define COMM_STATS_HIST	0
+#endif
+
+/* Timestamps taken from COMM_TICK: first byte of each received frame
+ * (just after the synchronization pattern) is stored with the packet,
+ * start and end of the last transmission in state. For time sync. */
+#ifndef COMM_STAMP
+#	define COMM_STAMP	0
+#endif
+
+/* Watchdog of frame reception. RXPoll(), called from the main loop or
+ * a timer interrupt, aborts a frame when no byte came for COMM_WD_GAP
+ * byte times or when it lasts longer than its length allows. With
+ * COMM_WD_LOST the interrupt also aborts a frame after that many bytes
+ * in a row came with neither DQD nor RSSI set - sender is gone and FIFO
+ * is filled with noise. Both restart synchronization search at once. */
+#ifndef COMM_WATCHDOG
+#	define COMM_WATCHDOG	0
+#endif
+#ifndef COMM_WD_GAP
+#	define COMM_WD_GAP	2
+#endif
+#ifndef COMM_WD_LOST
+#	define COMM_WD_LOST	2
+#endif
+
+/* Free running 16 bit timer used for timing (trace, histograms, stamps,
+ * watchdog) and its frequency [Hz] (For e.g. TCNT1 at 8MHz / 8) */
+#ifndef COMM_TICK
+#	define COMM_TICK	TCNT1
+#endif
+#ifndef COMM_TICK_HZ
+#	define COMM_TICK_HZ	1000000
+#endif
+
+/* Binary trace of interrupt events into a ring (COMM_TRACE entries,
+ * power of 2 up to 128; 0 - disabled). Each entry: event, status word and a
+ * timer tick read from COMM_TICK.
+ * Costs a few cycles per event, unlike DEBUG printfs in interrupt.
+ * Dump with TraceDump(), decode with Host/trace.py. */
+#ifndef COMM_TRACE
+#	define COMM_TRACE	0
+#endif
+
+/* Sniffer capture ring (COMM_SNIFF bytes, power of 2; 0 - disabled).
+ * Every attempted frame - also ones rejected at the header, failing CRC
+ * or aborted - is stored as it's received: record header (SniffHeadSize
+ * bytes: 0xA5, end event, raw byte count, first byte tick, status word;
+ * little endian) followed by the raw bytes. Bytes are written one by
+ * one in the interrupt and the record is committed at its end, so the
+ * capture costs a few cycles per byte. Frames which don't fit are
+ * truncated (event | 0x80) or dropped; dropped ones are reported with
+ * a T_NONE record. Read with SniffRead(), see Sniff.cc and
+ * Host/sniff2pcap.py. */
+#ifndef COMM_SNIFF
+#	define COMM_SNIFF	0
+#endif
 
 /* Debug (printfs) */
-#define COMM_DEBUG	0
+#ifndef COMM_DEBUG
+#	define COMM_DEBUG	0
+#endif
+
+/* RAM limit of an instance [bytes]; build fails if State (buffers,
+ * state, stats) is bigger. 0 - no limit. To see the RAM taken by each
+ * instance and configuration at build time:
+ *   avr-nm -C -S --size-sort -t d prog.elf | grep '::State$'
+ * (Cipher state is the '::Cipher' symbol); Host/comm_matrix.sh prints
+ * it for each combination it builds. */
+#ifndef COMM_RAM_MAX
+#	define COMM_RAM_MAX	0
+#endif
 
 /* Enable testcase compilation - requires stats compiled */
-#define COMM_TESTCASES	1
+#ifndef COMM_TESTCASES
+#	define COMM_TESTCASES	1
+#endif
+
+/* Instance: namespace and maximal message size.
+ * To drive another RFM12 include RF.cc and Comm.cc again with other
+ * RF_NS/RF_SS/RF_IRQ_* (see RF.cc), COMM_NS and optionally COMM_MAXMESG
+ * defined; testcases should be disabled for it (COMM_TESTCASES 0).
+ * Each instance has its own state, statistics and interrupt handler. */
+#ifndef COMM_NS
+#	define COMM_NS		Comm
+#endif
+#ifndef COMM_MAXMESG
+#	define COMM_MAXMESG	256
+#endif
 
 
 
 /* Internal helper */
 #define COMM_ANY_STATS	(COMM_STATS_RX || COMM_STATS_TX)
 
+/* Scatter/gather is a TX feature */
+#if !COMM_TX
+#	undef COMM_TXSG
+#	define COMM_TXSG	0
+#endif
+
+/* Shared buffer needs both directions and no pool */
+#if !COMM_TX || !COMM_RX || !COMM_TXBUFF || COMM_RXPOOL
+#	undef COMM_SHARED
+#	define COMM_SHARED	0
+#endif
+
+/* And the pool is a RX one */
+#if !COMM_RX
+#	undef COMM_SNIFF
+#	define COMM_SNIFF	0
+#	undef COMM_RXPOOL
+#	define COMM_RXPOOL	0
+#	undef COMM_QUALITY
+#	define COMM_QUALITY	0
+#	undef COMM_WATCHDOG
+#	define COMM_WATCHDOG	0
+#endif
+
+/* Reject combinations which can't work */
+#if !COMM_TX && !COMM_RX
+#	error "Comm: neither TX nor RX enabled"
+#endif
+#if COMM_TX && !COMM_TXBUFF && !COMM_TXSG
+#	error "Comm: TX requires TXBUFF or TXSG"
+#endif
+#if COMM_CIPHER && COMM_TX && !COMM_TXSG
+#	error "Comm: CIPHER requires TXSG"
+#endif
+#if COMM_TRACE & (COMM_TRACE - 1)
+#	error "Comm: COMM_TRACE must be a power of 2"
+#endif
+#if COMM_TRACE > 128
+#	error "Comm: COMM_TRACE above 128 doesn't fit the 8 bit ring index"
+#endif
+#if (COMM_SNIFF & (COMM_SNIFF - 1)) || COMM_SNIFF > 32768
+#	error "Comm: COMM_SNIFF must be a power of 2, at most 32768"
+#endif
+#if COMM_RXPOOL && (COMM_RXQUEUE & (COMM_RXQUEUE - 1))
+#	error "Comm: COMM_RXQUEUE must be a power of 2"
+#endif
+#if COMM_MAXMESG > 256
+#	error "Comm: COMM_MAXMESG doesn't fit len_t"
+#endif
+#if COMM_TESTCASES && !COMM_ANY_STATS
+#	error "Comm: testcases require stats"
+#endif
+
+#if COMM_TXSG
+#include <avr/pgmspace.h>
+#endif
+#if COMM_CIPHER && COMM_TX
+#include <avr/eeprom.h>
+#endif
+#include "Frame.h"
+
 /** RF Communication subsystem */
-namespace Comm {
+namespace COMM_NS {
+	/** RFM12 driven by this instance */
+	namespace RF = ::RF_NS;
+
 /*** Tranport layer configuration ***/
 
 	/** Type of size field: uint8_t for <= 255, uint16_t for <= 65536.
@@ -92,40 +367,74 @@ namespace Comm {
 
 #if COMM_CRC
 	typedef uint16_t	crc_t;		/**< CRC type */
-	const crc_t CRCInit	= 0xFFFF; 	/**< Initial CRC value */
+	const crc_t CRCInit	= FRAME_CRCINIT; 	/**< Initial CRC value */
 #endif
 
 #if COMM_CTR
 
 	typedef uint8_t		ctr_t;		/**< Control byte type */
+
+	/** Packet type description */
+	typedef union {
+		ctr_t Raw;
+		struct {
+			uint8_t Control : 4;
+			uint8_t Config : 4;
+		} C;
+	} type_t;
 #endif
 
 	/** Maximal size of data which can be transfered in one packet.
 	 * See CHECK0 */
-	const int MaxMesgSize	= 256;
+	const int MaxMesgSize	= COMM_MAXMESG;
+
+	/** Timer of this instance (COMM_TICK) and its frequency [Hz] */
+	const uint32_t TickHz	= COMM_TICK_HZ;
+	static inline uint16_t Tick(void)
+	{
+		return COMM_TICK;
+	}
 
 	/* Define size of additional packet bytes - without synchronization data */
 #if COMM_CTR
-#	define COMM_HEADSIZE	(sizeof(len_t) + sizeof(ctr_t))
+#	define COMM_HEADSIZE_	(sizeof(len_t) + sizeof(ctr_t))
 #else
-#	define COMM_HEADSIZE	(sizeof(len_t))
+#	define COMM_HEADSIZE_	(sizeof(len_t))
 #endif /* CTR */
+	/* + source and sequence (SEQ), + nonce (CIPHER) */
+#define COMM_HEADSIZE	(COMM_HEADSIZE_ + 2 * COMM_SEQ + 4 * COMM_CIPHER)
 
+	/* Tag (CIPHER) + CRC */
 #if COMM_CRC
-#	define COMM_TAILSIZE	(sizeof(crc_t))
+#	define COMM_TAILSIZE	(4 * COMM_CIPHER + sizeof(crc_t))
 #else
-#	define COMM_TAILSIZE	(0)
+#	define COMM_TAILSIZE	(4 * COMM_CIPHER)
 #endif /* CRC */
 
 #define COMM_PACKETSIZE (COMM_HEADSIZE + COMM_TAILSIZE)
+	/** Size of packet without data (usable outside the namespace) */
+	const uint8_t PacketSize = COMM_PACKETSIZE;
+	/** Size of packet header (length and control byte) */
+	const uint8_t HeadSize = COMM_HEADSIZE;
 
 
 #if COMM_TX
 	/* Frame synchronization data */
-#	define SynchData {0xAA, 0xAA, 0x2D, 0xD4}
-	const uint8_t SynchSize = 4;			/**< Synchronization size */
+#	define SynchData FRAME_SYNCH
+	const uint8_t SynchSize = FRAME_SYNCHSIZE;	/**< Synchronization size */
 #endif /* TX */
 
+#if COMM_QUALITY
+	/** Reception quality of a packet. Taken from status word
+	 * read anyway in the interrupt - no additional SPI traffic. */
+	typedef struct {
+		uint16_t Status;	/**< Status word at the last byte */
+		uint16_t RSSI;		/**< Bytes received with RSSI over threshold */
+		uint16_t DQD;		/**< Bytes received with DQD set */
+		int8_t Offset;		/**< AFC offset at the end of frame */
+	} quality_t;
+#endif /* QUALITY */
+
 	/** Structure of a packet */
 	typedef struct {
 		/** Message length */
@@ -133,17 +442,30 @@ namespace Comm {
 
 #if COMM_CTR
 		/** Packet type description */
-		union {
-			ctr_t Raw;
-			struct {
-				uint8_t Control : 4;
-				uint8_t Config : 4;
-			} C;
-		} Type;
+		type_t Type;
 #endif /* CTR */
 
-		/** Message body + 16 bit CRC at the end */
+#if COMM_SEQ
+		uint8_t Src;	/**< Sender id */
+		uint8_t Seq;	/**< Sequence number */
+#endif /* SEQ */
+
+#if COMM_CIPHER
+		uint32_t Nonce;	/**< Cipher nonce */
+#endif /* CIPHER */
+
+		/** Message body + (tag) + 16 bit CRC at the end */
 		char Mesg[MaxMesgSize + COMM_TAILSIZE];
+
+#if COMM_QUALITY
+		/** Filled on reception; not transmitted */
+		quality_t Quality;
+#endif /* QUALITY */
+
+#if COMM_STAMP && COMM_RX
+		/** COMM_TICK at the first byte; not transmitted */
+		uint16_t Stamp;
+#endif /* STAMP */
 	} packet_t;
 
 #if COMM_TX
@@ -160,6 +482,109 @@ namespace Comm {
 		} C;
 	} frame_t;
 #endif /* TX */
+
+#if COMM_TXSG
+	/** Frame header without data (synch + length + control) */
+	typedef union {
+		uint8_t Raw[SynchSize + COMM_HEADSIZE];
+		struct {
+			uint8_t Synch[SynchSize];
+			len_t Length;
+#if COMM_CTR
+			type_t Type;
+#endif /* CTR */
+#if COMM_SEQ
+			uint8_t Src;
+			uint8_t Seq;
+#endif /* SEQ */
+#if COMM_CIPHER
+			uint32_t Nonce;
+#endif /* CIPHER */
+		} C;
+	} head_t;
+
+	/** Segment flags: where the segment data lives */
+	enum SegFlags {
+		SG_RAM = 0x00,
+		SG_PGM = 0x01,	/**< Data placed in flash (PROGMEM) */
+	};
+
+	/** One part of a frame body sent with TXSend() */
+	typedef struct {
+		const void *Data;
+		len_t Length;
+		uint8_t Flags;
+	} segment_t;
+#endif /* TXSG */
+
+#if COMM_TRACE || COMM_SNIFF
+	/** Traced events (also end of sniffed frame); keep in sync
+	 * with Host/trace.py and Host/sniff2pcap.py */
+	enum TraceEvent {
+		T_NONE=0,
+		T_IDLE,		/**< Idle() */
+		T_RXINIT,	/**< RX started */
+		T_TXINIT,	/**< TX started */
+		T_SYNC,		/**< First byte after synchronization pattern */
+		T_HEAD,		/**< Header accepted */
+		T_HEADERR,	/**< Header rejected (control byte/length) */
+		T_RXEND,	/**< Frame received, CRC correct */
+		T_CRCERR,	/**< CRC error */
+		T_FFOV,		/**< RX FIFO overflow */
+		T_RGUR,		/**< TX register underrun */
+		T_TXEND,	/**< Frame transmitted */
+		T_ABORT,	/**< Frame aborted by watchdog */
+		T_DUP,		/**< Repeated frame dropped */
+		T_AUTHERR,	/**< Cipher tag mismatch */
+		T_REPLAY,	/**< Cipher nonce already used */
+	};
+#endif /* TRACE || SNIFF */
+
+#if COMM_TRACE
+	/** Trace ring entry */
+	typedef struct {
+		uint8_t Event;
+		uint16_t Status;
+		uint16_t Tick;
+	} trace_t;
+#endif /* TRACE */
+
+#if COMM_ANY_STATS
+	/** Statistics; each failure cause counted separately.
+	 * Read with StatsGet(), send with StatsExport(). */
+	typedef struct {
+		uint32_t PacketsTX;
+		uint32_t PacketsRX;
+		uint16_t RGUR;		/**< TX register underruns */
+		uint16_t FFOV;		/**< RX FIFO overflows */
+		uint16_t LenErr;	/**< Length out of range */
+		uint16_t CtrErr;	/**< Control byte mismatch */
+		uint16_t CRCErr;	/**< CRC errors */
+		uint16_t Aborted;	/**< Frames aborted by watchdog */
+		uint16_t Dup;		/**< Repeated frames dropped (COMM_SEQ) */
+		uint16_t AuthErr;	/**< Tag mismatches (COMM_CIPHER) */
+		uint16_t Replay;	/**< Replayed nonces (COMM_CIPHER) */
+#if COMM_STATS_HIST
+		uint16_t SizeHist[8];	/**< Received packets by Length / 32 */
+		uint16_t TimeHist[8];	/**< By time from sync to end: bucket b
+					   below 8 << b byte times, last one
+					   512 byte times and more */
+#endif /* HIST */
+	} stats_t;
+
+	/** Version of StatsExport() format */
+	const uint8_t StatsVersion = 7 + 0x10 * COMM_STATS_HIST;
+#endif /* ANY_STATS */
+
+#if COMM_SEQ && COMM_RX
+	/** Sequence window of one sender: Last and 7 before it */
+	typedef struct {
+		uint8_t Src;
+		uint8_t Last;
+		uint8_t Mask;	/**< Bit n - Last - n received */
+	} seqwin_t;
+#endif /* SEQ */
+
 	/** Working mode
 	 * Simplified:
 	 *
@@ -192,12 +617,42 @@ namespace Comm {
 	static volatile struct {
 		/* Buffers */
 #if COMM_TX
+#if COMM_TXBUFF
 		frame_t SendBuff;
+#endif /* TXBUFF */
 		volatile uint8_t *SendCur, *SendEnd;
 #endif /* TX */
 
+#if COMM_TXSG
+		/* Scatter/gather transmission. Header and tail are sent
+		 * using SendCur/SendEnd; segments in between. */
+		head_t SGHead;
+		uint8_t SGTail[COMM_TAILSIZE + 2];	/* (Tag) CRC + dummy bytes */
+		const segment_t *SGList;	/* NULL when TXBUFF is used */
+		const segment_t *SGSeg;		/* Next segment to load */
+		const uint8_t *SGCur;		/* Next byte to send */
+		len_t SGLen;			/* Bytes left in current segment */
+		uint8_t SGLeft;			/* Segments left to load */
+		uint8_t SGFlags;		/* Flags of current segment */
+		uint8_t SGCount;
+#if COMM_CTR
+		uint8_t SGConfig;		/* Config for the next TXSend */
+#endif /* CTR */
+#if COMM_CRC
+		crc_t SGHeadCRC;		/* Header CRC, for TX retry */
+#endif /* CRC */
+#endif /* TXSG */
+
 #if COMM_RX
+#if COMM_RXPOOL
+		packet_t *RecvPkt;		/* Buffer being filled or NULL */
+		packet_t *RXFree[COMM_RXQUEUE];	/* Given by application */
+		packet_t *RXDone[COMM_RXQUEUE];	/* Received, not taken */
+		uint8_t RXFreeHead, RXFreeTail;
+		uint8_t RXDoneHead, RXDoneTail;
+#elif !COMM_SHARED
 		packet_t RecvBuff;
+#endif /* RXPOOL */
 		volatile uint8_t *RecvCur, *RecvEnd;
 #endif /* RX */
 
@@ -205,23 +660,67 @@ namespace Comm {
 		enum Mode Mode;
 		uint16_t Status;
 
+#if COMM_SEQ
+#if COMM_TX
+		uint8_t TXSrc, TXSeq;
+		uint8_t TXRepeat;	/* Keep sequence number for next frame */
+#endif /* TX */
+#if COMM_RX
+		seqwin_t SeqWin[COMM_SEQ_SOURCES];
+		uint8_t SeqNext;	/* Window replaced next */
+#endif /* RX */
+#endif /* SEQ */
+
+#if COMM_QUALITY
+		/* Quality of frame being received */
+		uint16_t QRSSI, QDQD;
+#endif /* QUALITY */
+
+#if COMM_TRACE
+		trace_t Trace[COMM_TRACE];
+		uint8_t TraceHead;
+#endif /* TRACE */
+
+#if COMM_SNIFF
+		uint8_t Sniff[COMM_SNIFF];
+		uint16_t SniffHead;	/* End of committed records */
+		uint16_t SniffTail;	/* Read position */
+		uint16_t SniffRec;	/* Record being captured */
+		uint16_t SniffPos;	/* Its next byte */
+		uint8_t SniffFlags;	/* SNIFF_* */
+		uint8_t SniffEvent;	/* Last event of the frame */
+		uint16_t SniffLost;	/* Frames dropped, not reported yet */
+#endif /* SNIFF */
+
 		/* Stats */
 #if COMM_ANY_STATS
-		uint32_t PacketsTX;
-		uint32_t PacketsRX;
-		uint16_t CtrErr;	/* RGUR error, lenght range error,
-					   or control byte error */
+		stats_t Stats;
+#endif
+#if COMM_STATS_HIST || (COMM_STAMP && COMM_RX) || COMM_WATCHDOG || COMM_SNIFF
+		uint16_t SyncTick;	/* Time of first byte of frame */
+#endif
+#if COMM_WATCHDOG || COMM_STATS_HIST
+		uint16_t ByteTicks;	/* Byte time at current rate */
+#endif
+#if COMM_STATS_HIST
+		uint16_t HistTick;	/* Time of last byte */
+		uint32_t HistTicks;	/* Since sync; summed per byte, can't wrap */
+#endif /* HIST */
+#if COMM_WATCHDOG
+		uint16_t LastTick;	/* Time of last byte */
+		uint16_t FrameTicks;	/* Frame length limit; 0 - none */
+		uint8_t Lost;		/* Bytes in a row without signal */
+#endif /* WATCHDOG */
+#if COMM_STAMP && COMM_TX
+		uint16_t TXStart, TXEnd;	/* Time of last transmission */
 #endif
 
 #if COMM_CRC
-#if COMM_ANY_STATS
-		uint16_t CRCErr;	/* CRC error */
-#endif
 		/* Temporary used in RX and TX */
 		crc_t CRC;
 #endif /* CRC */
 
-#if COMM_TX /* Initialize constant synchronization data for TX mode */
+#if COMM_TX && COMM_TXBUFF /* Initialize constant synchronization data for TX mode */
 	} State = {
 		{SynchData}
 	};
@@ -229,6 +728,445 @@ namespace Comm {
 	} State;
 #endif /* TX */
 
+	/** RAM used by this Comm instance (buffers, state and stats) */
+	const uint16_t StateSize = sizeof(State);
+
+#if COMM_RAM_MAX
+	/* Size error here: State doesn't fit in COMM_RAM_MAX */
+	typedef char RAMCheck[sizeof(State) <= COMM_RAM_MAX ? 1 : -1];
+#endif /* RAM_MAX */
+
+#if COMM_ANY_STATS
+	/** Copy statistics consistently (interrupt-safe); optionally
+	 * reset them at the same time */
+	static void StatsGet(stats_t *Out, char Reset)
+	{
+		const uint8_t SReg = SREG;
+		cli();
+		*Out = *(stats_t *)&State.Stats;
+		if (Reset)
+			memset((void *)&State.Stats, 0, sizeof(stats_t));
+		SREG = SReg;
+	}
+
+	/** Compact binary export for sending to a collector:
+	 * version byte followed by stats_t (little endian).
+	 * Buff must hold StatsExportSize bytes. Returns length. */
+	const uint8_t StatsExportSize = 1 + sizeof(stats_t);
+	static uint8_t StatsExport(uint8_t *Buff, char Reset)
+	{
+		Buff[0] = StatsVersion;
+		StatsGet((stats_t *)(Buff + 1), Reset);
+		return StatsExportSize;
+	}
+#endif /* ANY_STATS */
+
+#if COMM_TRACE
+	/** Store event in trace ring */
+	static inline void Trace(uint8_t Event)
+	{
+		volatile trace_t *T = &State.Trace[State.TraceHead & (COMM_TRACE - 1)];
+		T->Event = Event;
+		T->Status = State.Status;
+		T->Tick = COMM_TICK;
+		State.TraceHead++;
+	}
+
+	/** Print trace, oldest entry first; one "T EV STATUS TICK" hex
+	 * line per entry. Tracing goes on during the dump: entries are
+	 * copied one at a time and those overwritten meanwhile (oldest
+	 * ones) are skipped; events after the start of the dump are left
+	 * for the next one. */
+	static void TraceDump(void)
+	{
+		const uint8_t SReg = SREG;
+		trace_t T;
+		uint8_t i, Head, Lost;
+
+		cli();
+		Head = State.TraceHead;
+		SREG = SReg;
+		for (i = 0; i < COMM_TRACE; i++) {
+			cli();
+			T = *(trace_t *)&State.Trace[(uint8_t)(Head + i) & (COMM_TRACE - 1)];
+			/* New events took slots Head..Head + Lost - 1 */
+			Lost = State.TraceHead - Head;
+			SREG = SReg;
+			if (Lost >= COMM_TRACE)
+				break;	/* Whole ring is new */
+			if (Lost > i || T.Event == T_NONE)
+				continue;
+			printf("T %02X %04X %04X\n", T.Event, T.Status, T.Tick);
+		}
+	}
+#endif /* TRACE */
+
+#if COMM_TRACE && COMM_SNIFF
+#	define COMM_T(Event)	do { State.SniffEvent = (Event); Trace(Event); } while (0)
+#elif COMM_TRACE
+#	define COMM_T(Event)	Trace(Event)
+#elif COMM_SNIFF
+#	define COMM_T(Event)	do { State.SniffEvent = (Event); } while (0)
+#else
+#	define COMM_T(Event)	do { } while (0)
+#endif /* TRACE / SNIFF */
+
+#if COMM_SNIFF
+	/***
+	 * Sniffer capture
+	 ***/
+	const uint8_t SniffHeadSize = 8;	/**< Record header */
+	const uint8_t SniffMark = 0xA5;		/**< First byte of a record */
+
+	/** Capture flags */
+	enum {
+		SNIFF_ON = 0x01,	/**< Record being captured */
+		SNIFF_TRUNC = 0x02,	/**< Ring filled up during the record */
+	};
+
+	/** Store one byte at ring position */
+	static inline void SniffPut(uint16_t Pos, uint8_t Byte)
+	{
+		State.Sniff[Pos & (COMM_SNIFF - 1)] = Byte;
+	}
+
+	/** Write record header at ring position */
+	static inline void SniffHeader(uint16_t Rec, uint8_t Event, uint16_t Count,
+				       uint16_t Tick, uint16_t Status)
+	{
+		SniffPut(Rec, SniffMark);
+		SniffPut(Rec + 1, Event);
+		SniffPut(Rec + 2, (uint8_t)Count);
+		SniffPut(Rec + 3, (uint8_t)(Count >> 8));
+		SniffPut(Rec + 4, (uint8_t)Tick);
+		SniffPut(Rec + 5, (uint8_t)(Tick >> 8));
+		SniffPut(Rec + 6, (uint8_t)Status);
+		SniffPut(Rec + 7, (uint8_t)(Status >> 8));
+	}
+
+	/** Free bytes in the ring after Pos */
+	static inline uint16_t SniffFree(uint16_t Pos)
+	{
+		return COMM_SNIFF - (uint16_t)(Pos - State.SniffTail);
+	}
+
+	/** First byte of a frame; report earlier losses with a T_NONE
+	 * record (lost frame count in the tick field), then reserve
+	 * place for the header */
+	static inline void SniffStart(void)
+	{
+		State.SniffFlags = 0;
+		State.SniffEvent = T_SYNC;
+		if (State.SniffLost) {
+			if (SniffFree(State.SniffHead) < 2 * SniffHeadSize) {
+				State.SniffLost++;
+				return;
+			}
+			SniffHeader(State.SniffHead, T_NONE, 0, State.SniffLost, 0);
+			State.SniffHead += SniffHeadSize;
+			State.SniffLost = 0;
+		} else if (SniffFree(State.SniffHead) < SniffHeadSize) {
+			State.SniffLost++;
+			return;
+		}
+		State.SniffRec = State.SniffHead;
+		State.SniffPos = State.SniffHead + SniffHeadSize;
+		State.SniffFlags = SNIFF_ON;
+	}
+
+	/** Raw byte of a frame */
+	static inline void SniffByte(uint8_t Byte)
+	{
+		if (!(State.SniffFlags & SNIFF_ON))
+			return;
+		if (!SniffFree(State.SniffPos)) {
+			State.SniffFlags |= SNIFF_TRUNC;
+			return;
+		}
+		SniffPut(State.SniffPos++, Byte);
+	}
+
+	/** Frame ended (received or dropped); commit its record */
+	static inline void SniffEnd(void)
+	{
+		if (!(State.SniffFlags & SNIFF_ON))
+			return;
+		SniffHeader(State.SniffRec,
+			    State.SniffEvent | (State.SniffFlags & SNIFF_TRUNC ? 0x80 : 0),
+			    State.SniffPos - State.SniffRec - SniffHeadSize,
+			    State.SyncTick, State.Status);
+		State.SniffHead = State.SniffPos;
+		State.SniffFlags = 0;
+	}
+
+	/** Copy up to Max bytes of committed records; returns count.
+	 * Records are split between calls at any byte. */
+	static uint16_t SniffRead(uint8_t *Buff, uint16_t Max)
+	{
+		const uint8_t SReg = SREG;
+		uint16_t Head, Tail, Count = 0;
+		cli();
+		Head = State.SniffHead;
+		SREG = SReg;
+		/* Only we write the tail; publish it once (16 bit store) */
+		Tail = State.SniffTail;
+		while (Tail != Head && Count < Max) {
+			Buff[Count++] = State.Sniff[Tail & (COMM_SNIFF - 1)];
+			Tail++;
+		}
+		cli();
+		State.SniffTail = Tail;
+		SREG = SReg;
+		return Count;
+	}
+
+#endif /* SNIFF */
+
+#if COMM_CIPHER
+	/***
+	 * Cipher
+	 ***/
+	const uint8_t CipherRounds = 27;	/**< Speck64/128 */
+
+	/** Block encryption in progress; done when Round == CipherRounds */
+	typedef struct {
+		uint32_t X, Y;
+		uint8_t Round;
+	} engine_t;
+
+	/** Last nonce accepted from a sender */
+	typedef struct {
+		uint8_t Used, Src;
+		uint32_t Last;
+	} peer_t;
+
+	/** Cipher state; used by the interrupt only while it's working */
+	static struct {
+		uint32_t RK[CipherRounds];	/* Round keys */
+#if COMM_TX
+		uint32_t TXNonce;	/* Nonce of next frame */
+		uint32_t NonceLimit;	/* First nonce not reserved */
+		uint32_t *NonceEE;	/* Reservation in EEPROM or NULL */
+		uint8_t NonceSet;	/* TX allowed */
+#endif /* TX */
+#if COMM_RX
+		peer_t Peer[COMM_CIPHER_PEERS];
+		uint8_t PeerNext;	/* Replaced next */
+#endif /* RX */
+
+		engine_t KS;		/* Next keystream block */
+		engine_t MAC;		/* CBC-MAC */
+		union {
+			uint32_t W[2];
+			uint8_t B[8];
+		} Key, Mac;		/* Current keystream; MAC input */
+		uint32_t Nonce;		/* Nonce of current frame */
+		uint32_t Block;		/* Keystream block counter */
+		len_t Pos, Length;	/* Body byte; body length */
+		uint16_t MacPos;	/* MAC input byte (header first) */
+		uint32_t Tag;		/* Tag of received body */
+#if COMM_TXSG
+		segment_t Seg;		/* TX buffer body for TXInit() */
+#endif /* TXSG */
+	} Cipher;
+
+#	define COMM_ROR(x, r)	(((x) >> (r)) | ((x) << (32 - (r))))
+#	define COMM_ROL(x, r)	(((x) << (r)) | ((x) >> (32 - (r))))
+
+	/** Set 128 bit key (k0, l0, l1, l2) */
+	static void CipherKey(const uint32_t *Key)
+	{
+		uint32_t K = Key[0], L[3] = {Key[1], Key[2], Key[3]}, N;
+		uint8_t i;
+		for (i = 0; i < CipherRounds; i++) {
+			Cipher.RK[i] = K;
+			N = (COMM_ROR(L[i % 3], 8) + K) ^ i;
+			K = COMM_ROL(K, 3) ^ N;
+			L[i % 3] = N;
+		}
+	}
+
+#if COMM_TX
+	/** Set nonce of the next frame and allow TX; it's incremented with
+	 * each frame. Caller guarantees it was never used with the key. */
+	static inline void CipherNonce(uint32_t Nonce)
+	{
+		Cipher.TXNonce = Nonce;
+		Cipher.NonceLimit = 0xFFFFFFFFUL;
+		Cipher.NonceEE = NULL;
+		Cipher.NonceSet = 1;
+	}
+
+	/** Store the end of next nonce block in EEPROM before using it;
+	 * returns 0 if the nonce space is used up (new key needed) */
+	static char CipherReserve(void)
+	{
+		const uint32_t Limit = Cipher.TXNonce + COMM_CIPHER_RESERVE;
+		/* 0xFFFFFFFF is erased EEPROM - never store it */
+		if (Limit < Cipher.TXNonce || Limit == 0xFFFFFFFFUL)
+			return 0;
+		eeprom_update_dword(Cipher.NonceEE, Limit);
+		Cipher.NonceLimit = Limit;
+		return 1;
+	}
+
+	/** Continue with the nonce reserved in EEPROM (erased - start at 0)
+	 * and allow TX. Returns 0 if the nonce space is used up. */
+	static char CipherNonceLoad(uint32_t *EE)
+	{
+		Cipher.TXNonce = eeprom_read_dword(EE);
+		if (Cipher.TXNonce == 0xFFFFFFFFUL)
+			Cipher.TXNonce = 0;
+		Cipher.NonceEE = EE;
+		Cipher.NonceSet = CipherReserve();
+		return Cipher.NonceSet;
+	}
+
+	/** Nonce for a new frame; returns 0 if TX isn't allowed */
+	static inline char CipherNonceTake(uint32_t *Nonce)
+	{
+		if (!Cipher.NonceSet)
+			return 0;
+		if (Cipher.TXNonce == Cipher.NonceLimit &&
+		    (!Cipher.NonceEE || !CipherReserve()))
+			return 0;
+		*Nonce = Cipher.TXNonce++;
+		return 1;
+	}
+#endif /* TX */
+
+#if COMM_RX
+	/** Accept nonce of a correctly received frame only if it's above
+	 * the last one of the sender; returns 0 for a replay */
+	static inline uint8_t CipherFresh(uint8_t Src, uint32_t Nonce)
+	{
+		peer_t *P;
+		uint8_t i;
+		for (i = 0; i < COMM_CIPHER_PEERS; i++) {
+			P = &Cipher.Peer[i];
+			if (P->Used && P->Src == Src) {
+				if (Nonce <= P->Last)
+					return 0;
+				P->Last = Nonce;
+				return 1;
+			}
+		}
+		P = &Cipher.Peer[Cipher.PeerNext];
+		Cipher.PeerNext = (Cipher.PeerNext + 1) % COMM_CIPHER_PEERS;
+		P->Used = 1;
+		P->Src = Src;
+		P->Last = Nonce;
+		return 1;
+	}
+#endif /* RX */
+
+	/** Run up to *Budget rounds of encryption */
+	static inline void CipherRun(engine_t *E, uint8_t *Budget)
+	{
+		uint32_t X = E->X, Y = E->Y;
+		uint8_t R = E->Round;
+		while (R < CipherRounds && *Budget) {
+			X = (COMM_ROR(X, 8) + Y) ^ Cipher.RK[R];
+			Y = COMM_ROL(Y, 3) ^ X;
+			R++;
+			(*Budget)--;
+		}
+		E->X = X;
+		E->Y = Y;
+		E->Round = R;
+	}
+
+	/** Finish block now */
+	static inline void CipherFinish(engine_t *E)
+	{
+		uint8_t Budget = CipherRounds;
+		CipherRun(E, &Budget);
+	}
+
+	/** Precompute; called once per byte interrupt */
+	static inline void CipherStep(void)
+	{
+		uint8_t Budget = COMM_CIPHER_ROUNDS;
+		CipherRun(&Cipher.KS, &Budget);
+		CipherRun(&Cipher.MAC, &Budget);
+	}
+
+	/** Header bytes after the length (control, Src/Seq) authenticated
+	 * in front of the body */
+	const uint8_t CipherHeadAuth = COMM_HEADSIZE_ - sizeof(len_t) + 2 * COMM_SEQ;
+
+	/**
+	 * \brief
+	 *   Start frame: first keystream block and MAC of the
+	 *   nonce/length block (MSB set - never a counter block).
+	 *   The rest of the header (control byte, Src, Seq) is the
+	 *   first MAC input, so none of it can be changed in the air.
+	 *
+	 * \param Head
+	 *   Packet header starting with the length byte.
+	 */
+	static inline void CipherStart(const volatile uint8_t *Head, uint32_t Nonce)
+	{
+		uint8_t i;
+		Cipher.KS.X = Nonce;
+		Cipher.KS.Y = 0;
+		Cipher.KS.Round = 0;
+		Cipher.MAC.X = Nonce;
+		Cipher.MAC.Y = 0x80000000UL | Head[0];
+		Cipher.MAC.Round = 0;
+		Cipher.Mac.W[0] = Cipher.Mac.W[1] = 0;
+		for (i = 0; i < CipherHeadAuth; i++)
+			Cipher.Mac.B[i] = Head[sizeof(len_t) + i];
+		Cipher.MacPos = CipherHeadAuth;
+		Cipher.Nonce = Nonce;
+		Cipher.Block = 0;
+		Cipher.Pos = 0;
+		Cipher.Length = Head[0];
+	}
+
+	/** Absorb MAC input block */
+	static inline void CipherAbsorb(void)
+	{
+		CipherFinish(&Cipher.MAC);
+		Cipher.MAC.X ^= Cipher.Mac.W[0];
+		Cipher.MAC.Y ^= Cipher.Mac.W[1];
+		Cipher.MAC.Round = 0;
+		Cipher.Mac.W[0] = Cipher.Mac.W[1] = 0;
+	}
+
+	/** Encrypt/decrypt next body byte; MAC is taken over plaintext */
+	static inline uint8_t CipherByte(uint8_t Byte, uint8_t Decrypt)
+	{
+		const uint8_t i = Cipher.Pos & 7;
+		const uint8_t m = Cipher.MacPos & 7;
+		if (i == 0) {
+			/* Take next keystream block, start the following one */
+			CipherFinish(&Cipher.KS);
+			Cipher.Key.W[0] = Cipher.KS.X;
+			Cipher.Key.W[1] = Cipher.KS.Y;
+			Cipher.KS.X = Cipher.Nonce;
+			Cipher.KS.Y = ++Cipher.Block;
+			Cipher.KS.Round = 0;
+		}
+		Byte ^= Cipher.Key.B[i];
+		Cipher.Mac.B[m] = Decrypt ? Byte : Byte ^ Cipher.Key.B[i];
+		if (m == 7)
+			CipherAbsorb();
+		Cipher.Pos++;
+		Cipher.MacPos++;
+		return Byte;
+	}
+
+	/** All body bytes done; finish the MAC. Returns 32 bit tag. */
+	static inline uint32_t CipherTag(void)
+	{
+		if (Cipher.MacPos & 7)
+			CipherAbsorb();	/* Zero padded */
+		CipherFinish(&Cipher.MAC);
+		return Cipher.MAC.X;
+	}
+#endif /* CIPHER */
+
 	/***
 	 * General functions
 	 ***/
@@ -238,20 +1176,154 @@ namespace Comm {
 		RF_IRQ_OFF();
 		RF::Mode(RF::ECO);
 		State.Mode = MI;
+		COMM_T(T_IDLE);
+	}
+
+	/** Initialize communication module */
+	static inline void Init(void)
+	{
+		RF::Init();
+		RF_IRQ_CONFIG();
+		Idle();
+	}
+
+#if COMM_RX
+	/***
+	 * RX functions
+	 ***/
+
+	/** Packet currently being received */
+	static inline volatile packet_t *RXCurPkt(void)
+	{
+#if COMM_RXPOOL
+		return State.RecvPkt;
+#elif COMM_SHARED
+		return &State.SendBuff.C.Packet;
+#else
+		return &State.RecvBuff;
+#endif /* RXPOOL */
+	}
+
+	/** Set state for reading the header of a next frame */
+	static inline void RXRewind(void)
+	{
+		State.Mode = Mr;
+#if COMM_CRC
+		State.CRC = CRCInit;
+#endif /* CRC */
+		State.RecvCur = (volatile uint8_t *)RXCurPkt();
+		/* We hit this when we know the frame length and control byte */
+		State.RecvEnd = State.RecvCur + COMM_HEADSIZE - 1;
+#if COMM_QUALITY
+		State.QRSSI = State.QDQD = 0;
+#endif /* QUALITY */
+#if COMM_WATCHDOG
+		State.FrameTicks = 0;
+		State.Lost = 0;
+#endif /* WATCHDOG */
+	}
+
+#if COMM_SEQ
+	/** Find window of a sender; NULL if not tracked */
+	static inline volatile seqwin_t *RXSeqWin(uint8_t Src)
+	{
+		uint8_t i;
+		for (i = 0; i < COMM_SEQ_SOURCES; i++)
+			if (State.SeqWin[i].Mask && State.SeqWin[i].Src == Src)
+				return &State.SeqWin[i];
+		return NULL;
+	}
+
+	/** Was this frame already received (called with the header) */
+	static inline uint8_t RXSeqSeen(uint8_t Src, uint8_t Seq)
+	{
+		volatile seqwin_t *W = RXSeqWin(Src);
+		const uint8_t Diff = W ? (uint8_t)(W->Last - Seq) : 8;
+		return Diff < 8 && (W->Mask & (1 << Diff));
+	}
+
+	/** Mark correctly received frame in the window. Frames older than
+	 * the window restart it (sender rebooted). */
+	static inline void RXSeqMark(uint8_t Src, uint8_t Seq)
+	{
+		volatile seqwin_t *W = RXSeqWin(Src);
+		const int8_t Diff = W ? (int8_t)(Seq - W->Last) : 0;
+		if (!W) {
+			W = &State.SeqWin[State.SeqNext];
+			State.SeqNext = (State.SeqNext + 1) % COMM_SEQ_SOURCES;
+			W->Src = Src;
+		}
+		if (!W->Mask || Diff >= 8 || Diff <= -8) {
+			W->Last = Seq;
+			W->Mask = 1;
+		} else if (Diff > 0) {
+			W->Last = Seq;
+			W->Mask = (W->Mask << Diff) | 1;
+		} else {
+			W->Mask |= 1 << -Diff;
+		}
+	}
+#endif /* SEQ */
+
+	/** Drop frame being received; restart synchronization search
+	 * or stop (RXRETRY) */
+	static inline void RXReset(void)
+	{
+#if COMM_SNIFF
+		SniffEnd();
+#endif /* SNIFF */
+		if (COMM_RXRETRY) {
+			RF::FIFOReset();
+			RXRewind();
+		} else {
+			State.Mode = MI;
+			RF::Mode(RF::DEF);
+			State.RecvCur = State.RecvEnd = NULL;
+			RF_IRQ_OFF();
+		}
+	}
+
+#if COMM_RXPOOL
+	/** Move next free buffer into reception; returns 0 if there is none
+	 * or there's no place to store it after it's filled. */
+	static inline uint8_t RXPoolNext(void)
+	{
+		if (State.RXFreeHead == State.RXFreeTail ||
+		    (uint8_t)(State.RXDoneHead - State.RXDoneTail) >= COMM_RXQUEUE) {
+			State.RecvPkt = NULL;
+			return 0;
+		}
+		State.RecvPkt = State.RXFree[State.RXFreeTail & (COMM_RXQUEUE-1)];
+		State.RXFreeTail++;
+		return 1;
 	}
 
-	/** Initialize communication module */
-	static inline void Init(void)
+	/** Give a buffer to the receiver. It belongs to Comm until
+	 * it's returned by RXTake(). Returns 0 if the pool is full. */
+	static inline char RXGive(packet_t *Buff)
 	{
-		RF::Init();
-		RF_IRQ_CONFIG();
-		Idle();
+		if ((uint8_t)(State.RXFreeHead - State.RXFreeTail) >= COMM_RXQUEUE)
+			return 0;
+		State.RXFree[State.RXFreeHead & (COMM_RXQUEUE-1)] = Buff;
+		State.RXFreeHead++;
+		return 1;
 	}
 
-#if COMM_RX
-	/***
-	 * RX functions
-	 ***/
+	/** Take a received packet; ownership returns to the caller.
+	 * Returns NULL (and Length 0) if nothing was received. */
+	static inline packet_t *RXTake(len_t *Length)
+	{
+		packet_t *Pkt;
+		if (State.RXDoneHead == State.RXDoneTail) {
+			*Length = 0;
+			return NULL;
+		}
+		Pkt = State.RXDone[State.RXDoneTail & (COMM_RXQUEUE-1)];
+		State.RXDoneTail++;
+		*Length = Pkt->Length;
+		return Pkt;
+	}
+#endif /* RXPOOL */
 
 	/** Initialize receiving */
 	static inline void RXInit()
@@ -260,21 +1332,64 @@ namespace Comm {
 		/* Ensure the interrupt is off while we configure RFM */
 		RF_IRQ_OFF();
 #endif
+#if COMM_RXPOOL
+		/* Nowhere to receive; RXWait() won't block */
+		if (!State.RecvPkt && !RXPoolNext()) {
+			State.Mode = MI;
+			return;
+		}
+#endif /* RXPOOL */
 		/* Swap modes and/or reset the FIFO */
 		if (RF::CurMode != RF::RX)
 			RF::Mode(RF::RX);
 
 		RF::VSendCommand(0x0000); /* Clear Status (FFOV for e.g.) */
-		State.Mode = Mr;
-#if COMM_CRC
-		State.CRC = CRCInit;
-#endif /* CRC */
-		State.RecvCur = (uint8_t *)&State.RecvBuff;
-		/* We hit this when we know the frame length and control byte */
-		State.RecvEnd = State.RecvCur + COMM_HEADSIZE - 1;
+		RXRewind();
+#if COMM_WATCHDOG || COMM_STATS_HIST
+		State.ByteTicks = (uint32_t)RF::ByteTime() * (COMM_TICK_HZ / 1000) / 1000;
+#endif /* WATCHDOG || HIST */
+		COMM_T(T_RXINIT);
 		RF_IRQ_ON();
 	}
 
+#if COMM_RXPOOL
+	/** Initialize receiving of a frame directly into Buff */
+	static inline char RXInit(packet_t *Buff)
+	{
+		if (!RXGive(Buff))
+			return 0;
+		RXInit();
+		return 1;
+	}
+#endif /* RXPOOL */
+
+#if COMM_WATCHDOG
+	/** Abort a stalled frame. Call periodically while receiving
+	 * (at least once per few byte times for a fast recovery). */
+	static void RXPoll(void)
+	{
+		const uint8_t SReg = SREG;
+		uint16_t Now;
+		cli();
+		/* Only when a frame is in progress */
+		if ((State.Mode == Mr || State.Mode == MR) &&
+		    State.RecvCur != (volatile uint8_t *)RXCurPkt()) {
+			Now = COMM_TICK;
+			if ((uint16_t)(Now - State.LastTick) >
+			    COMM_WD_GAP * State.ByteTicks ||
+			    (State.FrameTicks &&
+			     (uint16_t)(Now - State.SyncTick) > State.FrameTicks)) {
+				COMM_T(T_ABORT);
+#if COMM_STATS_RX
+				State.Stats.Aborted++;
+#endif /* STATS */
+				RXReset();
+			}
+		}
+		SREG = SReg;
+	}
+#endif /* WATCHDOG */
+
 	/** Wait indefinetely for either an correct packet (RXRETRY==1)
 	 * or for any packet receive trial.
 	 */
@@ -286,19 +1401,28 @@ namespace Comm {
 				break;
 			if (State.Mode == MX)
 				break;
+#if COMM_RXPOOL
+			if (State.RXDoneHead != State.RXDoneTail)
+				break;
+#endif /* RXPOOL */
 		}
 	}
 
 	/** Check if TX is ready */
 	static inline char RXReady(void)
 	{
+#if COMM_RXPOOL
+		if (State.RXDoneHead != State.RXDoneTail)
+			return 1;
+#endif /* RXPOOL */
 		return (State.Mode == MX) || (State.Mode == MI);
 	}
 
+#if !COMM_RXPOOL
 	/** Return RX buffer */
 	static inline char *RXGetBuff(void)
 	{
-		return (char *)State.RecvBuff.Mesg;
+		return (char *)RXCurPkt()->Mesg;
 	}
 
 
@@ -315,19 +1439,62 @@ namespace Comm {
 			*Length = 0;
 			return NULL;
 		}
-		*Length = State.RecvBuff.Length;
-		return (char *)State.RecvBuff.Mesg;
+		*Length = RXCurPkt()->Length;
+		return (char *)RXCurPkt()->Mesg;
 	}
 
 
+	/**
+	 * \brief
+	 *   Progress of frame being received, for acting on its
+	 *   beginning before the whole frame is in (For e.g. relaying).
+	 *
+	 * \param Length
+	 *   Set to the message length once header is accepted, 0 before.
+	 *
+	 * \return Number of packet bytes received (header included);
+	 *   0 if no frame is being received.
+	 */
+	static inline uint16_t RXGetCount(len_t *Length)
+	{
+		const uint8_t SReg = SREG;
+		uint16_t Count = 0;
+		cli();
+		*Length = 0;
+		if (State.Mode == Mr || State.Mode == MR) {
+			Count = State.RecvCur - (volatile uint8_t *)RXCurPkt();
+			if (State.Mode == MR)
+				*Length = RXCurPkt()->Length;
+		}
+		SREG = SReg;
+		return Count;
+	}
+
 #if COMM_CTR
 	/** Returns Config nibble from received packet */
 	static inline uint8_t RXGetConfig()
 	{
-		return State.RecvBuff.Type.C.Config;
+		return RXCurPkt()->Type.C.Config;
 	}
 #endif
 
+#if COMM_QUALITY
+	/** Returns reception quality of received packet */
+	static inline const quality_t *RXGetQuality()
+	{
+		return (const quality_t *)&RXCurPkt()->Quality;
+	}
+#endif /* QUALITY */
+
+#if COMM_STAMP
+	/** Returns COMM_TICK value at the first byte of received packet */
+	static inline uint16_t RXGetStamp()
+	{
+		return RXCurPkt()->Stamp;
+	}
+#endif /* STAMP */
+#endif /* !RXPOOL */
+
 #endif /* RX */
 
 #if COMM_TX
@@ -347,18 +1514,81 @@ namespace Comm {
 		return (State.Mode == Mt);
 	}
 
+#if COMM_TXBUFF
 	/** Get address to the TX buffer; */
 	static inline char *TXGetBuff(void)
 	{
 		return (char *)State.SendBuff.C.Packet.Mesg;
 	}
+#endif /* TXBUFF */
+
+#if COMM_STAMP
+	/** Returns COMM_TICK value at the start of last transmission */
+	static inline uint16_t TXGetStart(void)
+	{
+		return State.TXStart;
+	}
+
+	/** Returns COMM_TICK value at the end of last transmission
+	 * (valid after TXWait()). Unlike the start it doesn't depend on
+	 * transmitter turn-on time. */
+	static inline uint16_t TXGetEnd(void)
+	{
+		return State.TXEnd;
+	}
+#	define COMM_TXSTAMP()	(State.TXStart = COMM_TICK)
+#else
+#	define COMM_TXSTAMP()	do { } while (0)
+#endif /* STAMP */
+
+#if COMM_SEQ
+	/** Set sender id put in following frames */
+	static inline void TXSource(uint8_t Id)
+	{
+		State.TXSrc = Id;
+	}
+
+	/** Send the next frame with sequence number of the previous one,
+	 * so receivers which got it already drop it */
+	static inline void TXRepeat(void)
+	{
+		State.TXRepeat = 1;
+	}
+
+	/** Sequence number for the frame being initialized */
+	static inline uint8_t TXNextSeq(void)
+	{
+		if (State.TXRepeat)
+			State.TXRepeat = 0;
+		else
+			State.TXSeq++;
+		return State.TXSeq;
+	}
+#endif /* SEQ */
 
 #if COMM_CTR
-	/** Set config bits in packet header */
+	/** Set config bits in packet header. TXSend() copies them
+	 * into its header when called, so a frame in flight keeps
+	 * the value it was started with. */
 	static inline void TXConfig(uint8_t Cfg)
 	{
 		/* Copy 4 LSB bits into Config field */
+#if COMM_TXBUFF
 		State.SendBuff.C.Packet.Type.C.Config = Cfg;
+#endif /* TXBUFF */
+#if COMM_TXSG
+		State.SGConfig = Cfg & 0x0F;
+#endif /* TXSG */
+	}
+
+	/** Returns config bits set with TXConfig() */
+	static inline uint8_t TXGetConfig()
+	{
+#if COMM_TXSG
+		return State.SGConfig;
+#else
+		return State.SendBuff.C.Packet.Type.C.Config;
+#endif /* TXSG */
 	}
 #endif
 
@@ -370,13 +1600,34 @@ namespace Comm {
 	 *
 	 * \param Length
 	 *   Number of prepared bytes in TX buffer.
+	 *
+	 * \return 1 if the transmission was started; 0 with COMM_CIPHER
+	 *   if Length is 0 or there's no nonce (none set, or the nonce
+	 *   space is used up) - Mode doesn't change then.
 	 */
-	static void TXInit(len_t Length)
+#if COMM_TXBUFF
+#if COMM_CIPHER
+	static char TXSend(const segment_t *List, uint8_t Count);
+#endif /* CIPHER */
+
+	static char TXInit(len_t Length)
 	{
+#if COMM_CIPHER
+		/* Body is encrypted on the fly by the scatter/gather path */
+		Cipher.Seg.Data = (const void *)State.SendBuff.C.Packet.Mesg;
+		Cipher.Seg.Length = Length;
+		Cipher.Seg.Flags = SG_RAM;
+		return TXSend(&Cipher.Seg, 1);
+#else
 #if COMM_RX
 		/* Ensure the interrupt is off while we configure RFM */
 		RF_IRQ_OFF();
 #endif
+#if COMM_TXSG
+		/* Plain buffer transmission */
+		State.SGList = NULL;
+		State.SGLen = 0;
+#endif /* TXSG */
 
 		/* Turn on transmitter fast so the receiver might synchronize */
 		if (RF::CurMode != RF::TX)
@@ -387,6 +1638,10 @@ namespace Comm {
 #if COMM_CTR
 		State.SendBuff.C.Packet.Type.C.Control = ~Length;
 #endif /* CTR */
+#if COMM_SEQ
+		State.SendBuff.C.Packet.Src = State.TXSrc;
+		State.SendBuff.C.Packet.Seq = TXNextSeq();
+#endif /* SEQ */
 		State.SendCur = State.SendBuff.Raw + 1;
 		/* +1 - This will send a dummy byte in the end 
 		 * just not to shut down TX too early. */
@@ -402,7 +1657,9 @@ namespace Comm {
 		 * there should be time to calculate it.
 		 */
 		RF::Transmit(*State.SendBuff.Raw);
+		COMM_TXSTAMP();
 		RF::VSendCommand(0x0000); /* Clear Status (RGUR for e.g.) */
+		COMM_T(T_TXINIT);
 		RF_IRQ_ON();
 
 #if COMM_CRC
@@ -415,7 +1672,7 @@ namespace Comm {
 			/* Control bits set, start calculating CRC */
 			i = Length + COMM_HEADSIZE;
 			do {
-				State.CRC = _crc_ccitt_update(State.CRC, *Byte);
+				State.CRC = FrameCRCUpdate(State.CRC, *Byte);
 				Byte++;
 			} while (--i);
 			/* Store CRC at the end of the message */
@@ -424,6 +1681,178 @@ namespace Comm {
 			*Byte = (uint8_t)(State.CRC >> 8);
 		}
 #endif /* CRC */
+		return 1;
+#endif /* CIPHER */
+	}
+#endif /* TXBUFF */
+
+#if COMM_TXSG
+	/** Load next non-empty segment; returns 0 if there are none left */
+	static inline uint8_t TXSGLoad(void)
+	{
+		const segment_t *Seg;
+		while (State.SGLeft) {
+			Seg = State.SGSeg;
+			State.SGSeg = Seg + 1;
+			State.SGLeft--;
+			if (Seg->Length) {
+				State.SGCur = (const uint8_t *)Seg->Data;
+				State.SGLen = Seg->Length;
+				State.SGFlags = Seg->Flags;
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	/** All segments sent; place CRC and dummy bytes after them */
+	static inline void TXSGTail(void)
+	{
+#if COMM_CIPHER
+		{
+			uint32_t Tag = CipherTag();
+			uint8_t i;
+			for (i = 0; i < 4; i++) {
+				State.SGTail[i] = (uint8_t)Tag;
+				Tag >>= 8;
+#if COMM_CRC
+				State.CRC = FrameCRCUpdate(State.CRC, State.SGTail[i]);
+#endif /* CRC */
+			}
+		}
+#endif /* CIPHER */
+#if COMM_CRC
+		State.SGTail[4 * COMM_CIPHER] = (uint8_t)(State.CRC & 0x00FF);
+		State.SGTail[4 * COMM_CIPHER + 1] = (uint8_t)(State.CRC >> 8);
+#endif /* CRC */
+		State.SendCur = State.SGTail;
+		State.SendEnd = State.SGTail + sizeof(State.SGTail);
+	}
+
+	/** Set send pointers to the beginning of the scatter/gather frame;
+	 * first byte is sent directly by the caller. */
+	static inline void TXSGRewind(void)
+	{
+		State.SendCur = State.SGHead.Raw + 1;
+		State.SendEnd = State.SGHead.Raw + sizeof(head_t);
+		State.SGSeg = State.SGList;
+		State.SGLeft = State.SGCount;
+		State.SGLen = 0;
+		TXSGLoad();
+#if COMM_CRC
+		State.CRC = State.SGHeadCRC;
+#endif /* CRC */
+#if COMM_CIPHER
+		CipherStart(State.SGHead.Raw + SynchSize, State.SGHead.C.Nonce);
+#endif /* CIPHER */
+	}
+
+	/**
+	 * \brief
+	 *   Initializes transmission of a frame gathered from
+	 *   "Count" segments. Data is read from segments in
+	 *   the interrupt, so neither the list nor the data
+	 *   might be changed until TXWait() returns.
+	 *
+	 * \param List
+	 *   Array of segments (RAM or PROGMEM data)
+	 * \param Count
+	 *   Number of segments in array
+	 *
+	 * \return 0 if total length is 0 or doesn't fit in len_t
+	 *   (or no cipher nonce is available), 1 if the transmission
+	 *   was started.
+	 */
+	static char TXSend(const segment_t *List, uint8_t Count)
+	{
+		const uint8_t Synch[] = SynchData;
+		uint16_t Length = 0;
+		uint8_t i;
+
+#if COMM_CIPHER
+		uint32_t Nonce;
+#endif /* CIPHER */
+
+		for (i = 0; i < Count; i++)
+			Length += List[i].Length;
+		if (Length == 0 || Length > (len_t)~0)
+			return 0;
+#if COMM_CIPHER
+		if (!CipherNonceTake(&Nonce))
+			return 0;
+#endif /* CIPHER */
+
+#if COMM_RX
+		/* Ensure the interrupt is off while we configure RFM */
+		RF_IRQ_OFF();
+#endif
+
+		/* Turn on transmitter fast so the receiver might synchronize */
+		if (RF::CurMode != RF::TX)
+			RF::Mode(RF::TX);
+
+		for (i = 0; i < SynchSize; i++)
+			State.SGHead.C.Synch[i] = Synch[i];
+		State.SGHead.C.Length = Length;
+#if COMM_CTR
+		State.SGHead.C.Type.C.Control = ~Length;
+		State.SGHead.C.Type.C.Config = State.SGConfig;
+#endif /* CTR */
+#if COMM_SEQ
+		State.SGHead.C.Src = State.TXSrc;
+		State.SGHead.C.Seq = TXNextSeq();
+#endif /* SEQ */
+#if COMM_CIPHER
+		State.SGHead.C.Nonce = Nonce;
+#endif /* CIPHER */
+
+#if COMM_CRC
+		/* Header CRC; body is added byte by byte in the interrupt */
+		State.SGHeadCRC = CRCInit;
+		for (i = SynchSize; i < sizeof(head_t); i++)
+			State.SGHeadCRC = FrameCRCUpdate(State.SGHeadCRC,
+							 State.SGHead.Raw[i]);
+#endif /* CRC */
+
+		State.SGList = List;
+		State.SGCount = Count;
+		TXSGRewind();
+
+		State.Mode = MT;
+		RF::Transmit(*State.SGHead.Raw);
+		COMM_TXSTAMP();
+		RF::VSendCommand(0x0000); /* Clear Status (RGUR for e.g.) */
+		COMM_T(T_TXINIT);
+		RF_IRQ_ON();
+		return 1;
+	}
+
+#if COMM_CTR
+	/** TXSend() with Config bits set for this frame only; the ones
+	 * set with TXConfig() apply again to the following frames.
+	 * Modules mark their frames with it (Agg, Relay, TimeSync). */
+	static char TXSendConfig(const segment_t *List, uint8_t Count,
+				 uint8_t Config)
+	{
+		const uint8_t Prev = State.SGConfig;
+		char Ret;
+		State.SGConfig = Config & 0x0F;
+		Ret = TXSend(List, Count);
+		State.SGConfig = Prev;
+		return Ret;
+	}
+#endif /* CTR */
+#endif /* TXSG */
+
+	/** Stop transmission in progress; receiver gets a truncated
+	 * frame which fails CRC check */
+	static inline void TXAbort(void)
+	{
+		RF_IRQ_OFF();
+		if (State.Mode == MT) {
+			State.Mode = MI;
+			RF::Mode(RF::DEF);
+		}
 	}
 
 	/** Initialize RFM so it will start sending synchronization bytes already
@@ -484,14 +1913,26 @@ namespace Comm {
 			if (State.Mode == MT)
 #endif /* RX */
 			{
+				COMM_T(T_RGUR);
 #if COMM_STATS_TX
-				State.CtrErr++;
+				State.Stats.RGUR++;
 #endif /* STATS */
 
 				if (COMM_TXRETRY) {
 					/* TODO: Debug this. */
+#if COMM_TXSG
+					if (State.SGList) {
+						TXSGRewind();
+						RF::Transmit(*State.SGHead.Raw);
+						COMM_TXSTAMP();
+						return;
+					}
+#endif /* TXSG */
+#if COMM_TXBUFF
 					State.SendCur = State.SendBuff.Raw + 1;
 					RF::Transmit(*State.SendBuff.Raw);
+					COMM_TXSTAMP();
+#endif /* TXBUFF */
 				} else {
 					State.SendCur = State.SendEnd = NULL;
 					State.Mode = MI;
@@ -503,8 +1944,9 @@ namespace Comm {
 #endif /* TX */
 
 #if COMM_RX
+			COMM_T(T_FFOV);
 #if COMM_STATS_RX
-				State.CtrErr++;
+			State.Stats.FFOV++;
 #endif /* STATS */
 
 			/* RX mode - Reset receiver; we will wait 
@@ -525,11 +1967,40 @@ namespace Comm {
 			RF_SS_HIGH();
 
 			/* RGIT. Send next byte */
+#if COMM_TXSG
+			if (State.SendCur == State.SendEnd && State.SGLen) {
+				/* Scatter/gather: stream byte from segment */
+				uint8_t Byte;
+				if (State.SGFlags & SG_PGM)
+					Byte = pgm_read_byte(State.SGCur);
+				else
+					Byte = *State.SGCur;
+#if COMM_CIPHER
+				Byte = CipherByte(Byte, 0);
+#endif /* CIPHER */
+				RF::Transmit(Byte);
+				State.SGCur++;
+#if COMM_CRC
+				State.CRC = FrameCRCUpdate(State.CRC, Byte);
+#endif /* CRC */
+				if (--State.SGLen == 0 && !TXSGLoad())
+					TXSGTail();
+#if COMM_CIPHER
+				else
+					CipherStep();
+#endif /* CIPHER */
+				return;
+			}
+#endif /* TXSG */
 			if (State.SendCur == State.SendEnd) {
 				/* Dummy byte already sent; shutdown transmitter */
 				State.Mode = Mt;
+				COMM_T(T_TXEND);
+#if COMM_STAMP
+				State.TXEnd = COMM_TICK;
+#endif /* STAMP */
 #if COMM_STATS_TX
-				State.PacketsTX++;
+				State.Stats.PacketsTX++;
 #endif
 				/* We must leave TX on, so receiver will be 
 				 * able to synchronize to our clock fast enough.
@@ -545,6 +2016,10 @@ namespace Comm {
 			} else {
 				RF::Transmit(*State.SendCur);
 				State.SendCur++;
+#if COMM_CIPHER
+				/* Compute first blocks during the header */
+				CipherStep();
+#endif /* CIPHER */
 			}
 			return;
 		}
@@ -564,14 +2039,75 @@ namespace Comm {
 
 		/* Discard 2. status byte and read FIFO */
 		SPDR = 0x00;
+#if COMM_QUALITY
+		/* Count while SPI is busy */
+		if (RF12_S_RSSI(State.Status))
+			State.QRSSI++;
+		if (RF12_S_DQD(State.Status))
+			State.QDQD++;
+#endif /* QUALITY */
+#if COMM_WATCHDOG && COMM_WD_LOST
+		if (RF12_S_DQD(State.Status) || RF12_S_RSSI(State.Status))
+			State.Lost = 0;
+		else
+			State.Lost++;
+#endif /* WATCHDOG */
 		while (!(SPSR & (1<<SPIF)));
 		RF_SS_HIGH();
 
+#if COMM_TRACE || COMM_STATS_HIST || COMM_STAMP || COMM_WATCHDOG || COMM_SNIFF
+		if (State.RecvCur == (volatile uint8_t *)RXCurPkt()) {
+#if COMM_STATS_HIST || COMM_STAMP || COMM_WATCHDOG || COMM_SNIFF
+			State.SyncTick = COMM_TICK;
+#endif /* HIST || STAMP || WATCHDOG || SNIFF */
+#if COMM_STATS_HIST
+			State.HistTick = State.SyncTick;
+			State.HistTicks = 0;
+#endif /* HIST */
+#if COMM_SNIFF
+			SniffStart();
+#endif /* SNIFF */
+			COMM_T(T_SYNC);
+		}
+#endif /* TRACE || HIST || STAMP || WATCHDOG || SNIFF */
+#if COMM_STATS_HIST
+		{
+			const uint16_t Now = COMM_TICK;
+			State.HistTicks += (uint16_t)(Now - State.HistTick);
+			State.HistTick = Now;
+		}
+#endif /* HIST */
+#if COMM_WATCHDOG
+		State.LastTick = COMM_TICK;
+#if COMM_WD_LOST
+		if (State.Lost >= COMM_WD_LOST) {
+			/* Signal gone; rest of the frame is noise */
+			COMM_T(T_ABORT);
+#if COMM_STATS_RX
+			State.Stats.Aborted++;
+#endif /* STATS */
+			goto ResetRX;
+		}
+#endif /* WD_LOST */
+#endif /* WATCHDOG */
 		/* Store byte and calculate CRC */
 		*State.RecvCur = SPDR;
+#if COMM_SNIFF
+		SniffByte(SPDR);
+#endif /* SNIFF */
 #if COMM_CRC
-		State.CRC = _crc_ccitt_update(State.CRC, SPDR);
+		State.CRC = FrameCRCUpdate(State.CRC, SPDR);
 #endif /* CRC */
+#if COMM_CIPHER
+		/* CRC covers ciphertext; decrypt body in place */
+		if (State.Mode == MR && Cipher.Pos < Cipher.Length) {
+			*State.RecvCur = CipherByte(*State.RecvCur, 1);
+			if (Cipher.Pos == Cipher.Length)
+				Cipher.Tag = CipherTag();
+			else
+				CipherStep();
+		}
+#endif /* CIPHER */
 		/* Handle end of header and end of body */
 		if (State.RecvCur == State.RecvEnd) {
 			if (State.Mode == Mr) {
@@ -579,31 +2115,59 @@ namespace Comm {
 
 				/* We know length and have received the control byte */
 #if COMM_CTR
-				if (State.RecvBuff.Type.C.Control != 
-				    ((~State.RecvBuff.Length) & 0x0F)) {
+				if (RXCurPkt()->Type.C.Control != 
+				    FRAME_CONTROL(RXCurPkt()->Length)) {
+					COMM_T(T_HEADERR);
 #if COMM_STATS_RX
-					State.CtrErr++;
+					State.Stats.CtrErr++;
 #endif /* STATS */
 					goto ResetRX;
 				}
 #endif /* CTR */
 
 				/* CHECK0: If maxsize of len_t is greater than
-				 * MaxMesgSize - we should swap those ifs  
+				 * MaxMesgSize the length must be checked against
+				 * the buffer; compiled out otherwise.
 				 */
-				/* if (State.RecvBuff.Length < 1 ||
-				   State.RecvBuff.Length > MaxMesgSize) { */
-				if (State.RecvBuff.Length == 0) {
+				if (RXCurPkt()->Length == 0 ||
+				    (MaxMesgSize < (len_t)~0 &&
+				     RXCurPkt()->Length > MaxMesgSize)) {
+					COMM_T(T_HEADERR);
+#if COMM_STATS_RX
+					State.Stats.LenErr++;
+#endif /* STATS */
+					goto ResetRX;
+				}
+#if COMM_SEQ
+				/* Drop repeated frame before its body */
+				if (RXSeqSeen(RXCurPkt()->Src, RXCurPkt()->Seq)) {
+					COMM_T(T_DUP);
 #if COMM_STATS_RX
-					State.CtrErr++;
+					State.Stats.Dup++;
 #endif /* STATS */
 					goto ResetRX;
 				}
+#endif /* SEQ */
+				COMM_T(T_HEAD);
 
 				/* Seems ok - replace RecvEnd position. */
 				State.RecvEnd = State.RecvCur + 
-					State.RecvBuff.Length + COMM_TAILSIZE;
+					RXCurPkt()->Length + COMM_TAILSIZE;
 				State.Mode = MR;
+#if COMM_CIPHER
+				CipherStart((const volatile uint8_t *)RXCurPkt(),
+					    RXCurPkt()->Nonce);
+#endif /* CIPHER */
+#if COMM_WATCHDOG
+				{
+					/* Whole frame with slack; no limit if
+					 * it doesn't fit the 16 bit timer */
+					const uint32_t T = (uint32_t)State.ByteTicks *
+						(RXCurPkt()->Length + COMM_PACKETSIZE +
+						 COMM_WD_GAP);
+					State.FrameTicks = T > 0xFFFF ? 0 : T;
+				}
+#endif /* WATCHDOG */
 			} else {
 				/* Mode == MR; reading body of packet */
 
@@ -611,20 +2175,92 @@ namespace Comm {
 				/* Check if received correctly */
 				if (State.CRC == 0x0000) {
 #endif /* CRC */
+#if COMM_CIPHER
+					/* Tag follows the body, little endian */
+					{
+						const volatile uint8_t *T = (const volatile uint8_t *)
+							RXCurPkt()->Mesg + RXCurPkt()->Length;
+						if (T[0] != (uint8_t)Cipher.Tag ||
+						    T[1] != (uint8_t)(Cipher.Tag >> 8) ||
+						    T[2] != (uint8_t)(Cipher.Tag >> 16) ||
+						    T[3] != (uint8_t)(Cipher.Tag >> 24)) {
+							COMM_T(T_AUTHERR);
+#if COMM_STATS_RX
+							State.Stats.AuthErr++;
+#endif /* STATS */
+							goto ResetRX;
+						}
+					}
+#if COMM_SEQ
+					if (!CipherFresh(RXCurPkt()->Src, RXCurPkt()->Nonce)) {
+#else
+					if (!CipherFresh(0, RXCurPkt()->Nonce)) {
+#endif /* SEQ */
+						COMM_T(T_REPLAY);
+#if COMM_STATS_RX
+						State.Stats.Replay++;
+#endif /* STATS */
+						goto ResetRX;
+					}
+#endif /* CIPHER */
 					/* CRC correct; Frame received! */
-					RF::Mode(RF::DEF);
-					RF_IRQ_OFF();
+					COMM_T(T_RXEND);
+#if COMM_SNIFF
+					SniffEnd();
+#endif /* SNIFF */
+#if COMM_QUALITY
+					RXCurPkt()->Quality.Status = State.Status;
+					RXCurPkt()->Quality.RSSI = State.QRSSI;
+					RXCurPkt()->Quality.DQD = State.QDQD;
+					/* Sign-extend 5 bit offset */
+					RXCurPkt()->Quality.Offset =
+						(int8_t)(RF12_S_OFFS(State.Status) << 3) >> 3;
+#endif /* QUALITY */
+#if COMM_STAMP
+					RXCurPkt()->Stamp = State.SyncTick;
+#endif /* STAMP */
+#if COMM_SEQ
+					RXSeqMark(RXCurPkt()->Src, RXCurPkt()->Seq);
+#endif /* SEQ */
 #if COMM_STATS_RX
-					State.PacketsRX++;
+					State.Stats.PacketsRX++;
+#if COMM_STATS_HIST
+					State.Stats.SizeHist[RXCurPkt()->Length >> 5]++;
+					{
+						/* Log2 scale from 8 byte times; no
+						 * division in the interrupt */
+						uint32_t Limit = (uint32_t)State.ByteTicks << 3;
+						uint8_t b = 0;
+						while (State.HistTicks >= Limit && b < 7) {
+							Limit <<= 1;
+							b++;
+						}
+						State.Stats.TimeHist[b]++;
+					}
+#endif /* HIST */
 #endif /* STATS */
+#if COMM_RXPOOL
+					/* Hand buffer over and continue with next */
+					State.RXDone[State.RXDoneHead & (COMM_RXQUEUE-1)] =
+						State.RecvPkt;
+					State.RXDoneHead++;
+					if (RXPoolNext()) {
+						RF::FIFOReset();
+						RXRewind();
+						return;
+					}
+#endif /* RXPOOL */
+					RF::Mode(RF::DEF);
+					RF_IRQ_OFF();
 					State.Mode = MX;
 					return;
 #if COMM_CRC
 				}
 
 				/* CRC Error */
+				COMM_T(T_CRCERR);
 #if COMM_STATS_RX
-				State.CRCErr++;
+				State.Stats.CRCErr++;
 #endif
 				goto ResetRX;
 #endif /* CRC */
@@ -635,24 +2271,12 @@ namespace Comm {
 
 		/* Reset the RX machinery */
 	ResetRX:
-		if (COMM_RXRETRY) {
-			RF::FIFOReset();
-			State.Mode = Mr;
-#if COMM_CRC
-			State.CRC = CRCInit;
-#endif /* CRC */
-			State.RecvCur = (uint8_t *)&State.RecvBuff;
-			State.RecvEnd = State.RecvCur + COMM_HEADSIZE - 1;
-		} else {
-			State.Mode = MI;
-			RF::Mode(RF::DEF);
-			State.RecvCur = State.RecvEnd = NULL;
-			RF_IRQ_OFF();
-		}
+		RXReset();
 #endif /* RX */
 	}
 
 
+#if COMM_TESTCASES
 /*************************
  * Testcases / Examples
  * 
@@ -660,7 +2284,25 @@ namespace Comm {
  * uart or LCD.
  ************************/
 
-#if COMM_RX
+	/** Print error counters after the packet count. Short - for the
+	 * 21 column LCD status line: length+control, CRC, overflows and
+	 * underruns, frames dropped by watchdog, dedup or cipher. */
+	static inline void TestcaseErrors(const Comm::stats_t *S, char Short)
+	{
+		if (Short) {
+			printf(" E:%u/%u/%u/%u",
+			       S->LenErr + S->CtrErr, S->CRCErr,
+			       S->FFOV + S->RGUR,
+			       S->Aborted + S->Dup + S->AuthErr + S->Replay);
+			return;
+		}
+		printf(" Err: len %u ctr %u crc %u ffov %u rgur %u"
+		       " abort %u dup %u auth %u replay %u\n",
+		       S->LenErr, S->CtrErr, S->CRCErr, S->FFOV, S->RGUR,
+		       S->Aborted, S->Dup, S->AuthErr, S->Replay);
+	}
+
+#if COMM_RX && !COMM_RXPOOL
 	/** Comm testcase */
 	static inline void Testcase_RX()
 	{
@@ -668,12 +2310,12 @@ namespace Comm {
 		unsigned int c;
 		char *Buff;
 		Comm::len_t Length;
-
-		/* Stabilize hardware */
-		Util::SDelay(1);
+		Comm::stats_t S;
 
 		/* Initialize Comm module */
 		Comm::Init();
+		printf("Boot %s: %uus RAM: %u\n", RF::Boot.Warm ? "warm" : "cold",
+		       RF::Boot.Time, Comm::StateSize);
 		sei();
 		c = 0;
 		for (;;)
@@ -686,16 +2328,9 @@ namespace Comm {
 			Buff[Length] = '\0';
 			printf("Got; MODE=%02X; Len=%u MSG=%s\n", Comm::State.Mode, Length, Buff);
 			c++;
-#if COMM_CRC
-			printf("RX: %lu Err: %u/%u\n",
-			       Comm::State.PacketsRX, 
-			       Comm::State.CtrErr,
-			       Comm::State.CRCErr);
-#else
-			printf("RX: %lu Err: %u\n",
-			       Comm::State.PacketsRX,
-			       Comm::State.CtrErr);
-#endif /* CRC */
+			Comm::StatsGet(&S, 0);
+			printf("RX: %lu", S.PacketsRX);
+			TestcaseErrors(&S, 0);
 #if RF_MASTER
 			LCD::Refresh();
 			LCD::ClearScreen();
@@ -711,18 +2346,14 @@ namespace Comm {
 	 */
 	static inline void Testcase_UART_RX()
 	{
-		unsigned int c;
 		Comm::len_t Length, i;
 		char *Buff;
 		char x, y;
-
-		/* Stabilize hardware */
-		Util::SDelay(1);
+		Comm::stats_t S;
 
 		/* Initialize Comm module */
 		Comm::Init();
 		sei();
-		c = 0;
 	        putchar(0x01); /* Enable overwrite mode */
 		LCD::ClearScreen();
 		printf("Terminal running\n");
@@ -766,23 +2397,57 @@ namespace Comm {
 				}
 			}
 			LCD::GotoXY(0,7);
-#if COMM_CRC
-			printf("RX%lu Err:%u/%u",
-			       Comm::State.PacketsRX, Comm::State.CtrErr, 
-			       Comm::State.CRCErr);
-#else
-			printf("RX%lu Err:%u",
-			       Comm::State.PacketsRX, Comm::State.CtrErr);
-#endif
+			Comm::StatsGet(&S, 0);
+			printf("RX%lu", S.PacketsRX);
+			TestcaseErrors(&S, 1);
 			LCD::GotoXY(x, y); 
 			LCD::Refresh(); 
 		}
 	}
 
 #endif /* RF_MASTER */
-#endif /* RX */
+#endif /* RX + !RXPOOL */
 
-#if COMM_TX
+#if COMM_RXPOOL
+	/** Pool testcase; receives continuously into application buffers
+	 * and prints them in the order received. */
+	static inline void Testcase_RXPool()
+	{
+		static packet_t Pool[COMM_RXQUEUE];
+		packet_t *Pkt;
+		Comm::len_t Length;
+		uint8_t i;
+		Comm::stats_t S;
+
+		/* Initialize Comm module */
+		Comm::Init();
+		for (i = 0; i < COMM_RXQUEUE; i++)
+			Comm::RXGive(&Pool[i]);
+		sei();
+		for (;;)
+		{
+			/* (Re)start receiving if it stopped for lack of buffers */
+			if (Comm::State.Mode == MI || Comm::State.Mode == MX)
+				Comm::RXInit();
+			Comm::RXWait();
+			while ((Pkt = Comm::RXTake(&Length)) != NULL) {
+				Pkt->Mesg[Length] = '\0';
+				printf("Got; Len=%u MSG=%s\n", Length, Pkt->Mesg);
+				/* Return buffer to the pool */
+				Comm::RXGive(Pkt);
+			}
+			Comm::StatsGet(&S, 0);
+			printf("RX: %lu", S.PacketsRX);
+			TestcaseErrors(&S, 0);
+#if RF_MASTER
+			LCD::Refresh();
+			LCD::ClearScreen();
+#endif
+		}
+	}
+#endif /* RXPOOL */
+
+#if COMM_TX && COMM_TXBUFF
 	/** Comm testcase */
 	static inline void Testcase_TX(void)
 	{
@@ -790,12 +2455,12 @@ namespace Comm {
 		char *Buff;
 		unsigned long i=0;
 		int Length;
-
-		/* Stabilize hardware */
-		Util::SDelay(1);
+		Comm::stats_t S;
 
 		/* Start Comm module */
 		Comm::Init();
+		printf("Boot %s: %uus RAM: %u\n", RF::Boot.Warm ? "warm" : "cold",
+		       RF::Boot.Time, Comm::StateSize);
 
 		/* Initialize buffer */
 		Buff = Comm::TXGetBuff();
@@ -809,14 +2474,18 @@ namespace Comm {
 		{
 			i++;
 			/* Start transmitting */
-			Comm::TXInit(Length);
+			if (!Comm::TXInit(Length)) {
+				printf("TX refused\n");
+				continue;
+			}
 			/* Wait until finish */
 			Comm::TXWait();
 
 			if (i % 100 == 0) {
 				/* Periodically display debug */
 
-				printf("PTx=%lu\n", Comm::State.PacketsTX);
+				Comm::StatsGet(&S, 0);
+				printf("PTx=%lu\n", S.PacketsTX);
 				RF::Status();
 #if RF_MASTER
 				LCD::Refresh();
@@ -834,9 +2503,6 @@ namespace Comm {
 		int i=0;
 		int Length;
 
-		/* Stabilize hardware */
-		Util::SDelay(1);
-
 		/* Start Comm module */
 		Comm::Init();
 
@@ -859,7 +2525,10 @@ namespace Comm {
 				Buff[Length++] = (unsigned char)i;
 			}
 
-			Comm::TXInit(Length);
+			if (!Comm::TXInit(Length)) {
+				printf("TX refused\n");
+				continue;
+			}
 			printf("%d\n", Length);
 			Comm::TXWait();
 		}
@@ -872,9 +2541,6 @@ namespace Comm {
 		unsigned int i=0;
 		int Length;
 
-		/* Stabilize hardware */
-		Util::SDelay(1);
-
 		printf("Initializing Comm\n");
 		/* Start Comm module */
 		Comm::Init();
@@ -887,7 +2553,8 @@ namespace Comm {
 		{
 			Length = sprintf(Buff, "~This is PX no %u", i);
 			printf("Transfering\n");
-			Comm::TXInit(Length);
+			if (!Comm::TXInit(Length))
+				printf("TX refused\n");
 			Comm::TXWait();
 			
 			Util::SDelay(1);
@@ -895,36 +2562,85 @@ namespace Comm {
 		}
 	}
 
-#endif /* TX */
+#endif /* TX + TXBUFF */
+
+#if COMM_TXSG
+	/** Constant part of TXSG testcase frame, kept in flash */
+	static const char TXSGBody[] PROGMEM =
+		"\x60\x61\x62\x63\x64\x65\x66\x67\x68\x69"
+		"\x6a\x6b\x6c\x6d\x6e\x6f\x70\x71\x72\x73";
+
+	/** Scatter/gather testcase: RAM counter + constant flash body
+	 * sent without copying into the TX buffer */
+	static inline void Testcase_TXSG(void)
+	{
+		char Head[12];
+		unsigned long i=0;
+		segment_t Seg[2];
+		Comm::stats_t S;
+
+		/* Start Comm module */
+		Comm::Init();
 
+		Seg[0].Data = Head;
+		Seg[0].Flags = SG_RAM;
+		Seg[1].Data = TXSGBody;
+		Seg[1].Length = sizeof(TXSGBody) - 1;
+		Seg[1].Flags = SG_PGM;
 
-#if COMM_RX && COMM_TX
+		sei();
+		for (;;)
+		{
+			i++;
+			/* Head might be changed only after TXWait() */
+			Seg[0].Length = sprintf(Head, "%lu:", i);
+			Comm::TXSend(Seg, 2);
+			Comm::TXWait();
+
+			if (i % 100 == 0) {
+				Comm::StatsGet(&S, 0);
+				printf("PTx=%lu\n", S.PacketsTX);
+#if RF_MASTER
+				LCD::Refresh();
+				LCD::ClearScreen();
+#endif /* RF_MASTER  */
+			}
+		}
+	}
+#endif /* TXSG */
+
+
+#if COMM_RX && COMM_TX && COMM_TXBUFF
 	/** Comm testcase, interleaved TX/RX */
 	static inline void Testcase_Interleaved(void)
 	{
 		char *Buff;
 		unsigned long i=0;
 		int Length;
-
-		/* Stabilize hardware */
-		Util::SDelay(1);
+		Comm::stats_t S;
 
 		/* Start Comm module */
 		Comm::Init();
-
-		/* Initialize buffer */
-		Buff = Comm::TXGetBuff();
-		Length = 0x13;
-		strncpy(Buff,
-			"\x60\x61\x62\x63\x64\x65\x66\x67\x68\x69"
-			"\x6a\x6b\x6c\x6d\x6e\x6f\x70\x71\x72\x73", Length);
+		printf("Boot %s: %uus RAM: %u\n", RF::Boot.Warm ? "warm" : "cold",
+		       RF::Boot.Time, Comm::StateSize);
 
 		sei();
 		for (;;)
 		{
 			i++;
+			/* Fill buffer each time; with COMM_SHARED reception
+			 * overwrites it */
+			Buff = Comm::TXGetBuff();
+			Length = 0x13;
+			strncpy(Buff,
+				"\x60\x61\x62\x63\x64\x65\x66\x67\x68\x69"
+				"\x6a\x6b\x6c\x6d\x6e\x6f\x70\x71\x72\x73", Length);
+
 			/* Start transmitting */
-			TXInit(Length);
+			if (!TXInit(Length)) {
+				printf("TX refused\n");
+				continue;
+			}
 			/* Wait until finish */
 			Comm::TXWait();
 
@@ -947,28 +2663,21 @@ namespace Comm {
 			Comm::TXPreInit();
 
 
-#if COMM_CRC
+			Comm::StatsGet(&S, 0);
 #if !RF_MASTER
-			printf("TX/RX %lu/%lu Err: %u/%u W: %d\n",
-			       Comm::State.PacketsTX,
-			       Comm::State.PacketsRX, 
-			       Comm::State.CtrErr,
-			       Comm::State.CRCErr,
+			printf("TX/RX %lu/%lu W: %d",
+			       S.PacketsTX,
+			       S.PacketsRX,
 			       WaitCnt);
+			TestcaseErrors(&S, 0);
 #else
-			printf("\x01TX/RX %lu/%lu  \nErr: %u/%u W:%d \n",
-			       Comm::State.PacketsTX,
-			       Comm::State.PacketsRX, 
-			       Comm::State.CtrErr,
-			       Comm::State.CRCErr,
+			printf("\x01TX/RX %lu/%lu  \nW:%d",
+			       S.PacketsTX,
+			       S.PacketsRX,
 			       WaitCnt);
+			TestcaseErrors(&S, 1);
+			printf(" \n");
 #endif
-#else
-			printf("TX/RX: %lu Err: %u\n",
-			       Comm::State.PacketsTX,
-			       Comm::State.PacketsRX,
-			       Comm::State.CtrErr);
-#endif /* CRC */
 
 #if RF_MASTER
 			LCD::Refresh();
@@ -979,4 +2688,132 @@ namespace Comm {
 #endif /* TX + RX */
 
 
+#endif /* TESTCASES */
 }
+
+/* Feature switches of the primary instance for modules; undefined
+ * (0 in #if) when the feature is off */
+#ifndef COMM1
+#	define COMM1	1
+#	if COMM_TX
+#		define COMM1_TX	1
+#	endif
+#	if COMM_RX
+#		define COMM1_RX	1
+#	endif
+#	if COMM_CRC
+#		define COMM1_CRC	1
+#	endif
+#	if COMM_CTR
+#		define COMM1_CTR	1
+#	endif
+#	if COMM_TXSG
+#		define COMM1_TXSG	1
+#	endif
+#	if COMM_TXBUFF
+#		define COMM1_TXBUFF	1
+#	endif
+#	if COMM_SHARED
+#		define COMM1_SHARED	1
+#	endif
+#	if COMM_SEQ
+#		define COMM1_SEQ	1
+#	endif
+#	if COMM_CIPHER
+#		define COMM1_CIPHER	1
+#	endif
+#	if COMM_TXRETRY
+#		define COMM1_TXRETRY	1
+#	endif
+#	if COMM_RXPOOL
+#		define COMM1_RXPOOL	1
+#	endif
+#	if COMM_RXRETRY
+#		define COMM1_RXRETRY	1
+#	endif
+#	if COMM_QUALITY
+#		define COMM1_QUALITY	1
+#	endif
+#	if COMM_STATS_TX
+#		define COMM1_STATS_TX	1
+#	endif
+#	if COMM_STATS_RX
+#		define COMM1_STATS_RX	1
+#	endif
+#	if COMM_STATS_HIST
+#		define COMM1_STATS_HIST	1
+#	endif
+#	if COMM_STAMP
+#		define COMM1_STAMP	1
+#	endif
+#	if COMM_WATCHDOG
+#		define COMM1_WATCHDOG	1
+#	endif
+#	if COMM_TRACE
+#		define COMM1_TRACE	1
+#	endif
+#	if COMM_SNIFF
+#		define COMM1_SNIFF	1
+#	endif
+#	if COMM_DEBUG
+#		define COMM1_DEBUG	1
+#	endif
+#	if COMM_TESTCASES
+#		define COMM1_TESTCASES	1
+#	endif
+#endif
+
+/* Free instance configuration for another inclusion */
+#undef RF_NS
+#undef RF_SS
+#undef RF_IRQ_PIN
+#undef RF_IRQ_PORT
+#undef RF_IRQ_DDR
+#undef RF_IRQ_MASK
+#undef RF_IRQ_vect
+#undef RF_IRQ_CONFIG
+#undef RF_IRQ_ON
+#undef RF_IRQ_OFF
+#undef COMM_NS
+#undef COMM_MAXMESG
+#undef COMM_TESTCASES
+#undef COMM_TX
+#undef COMM_RX
+#undef COMM_CRC
+#undef COMM_CTR
+#undef COMM_TXSG
+#undef COMM_TXBUFF
+#undef COMM_SHARED
+#undef COMM_SEQ
+#undef COMM_CIPHER
+#undef COMM_TXRETRY
+#undef COMM_RXPOOL
+#undef COMM_RXRETRY
+#undef COMM_QUALITY
+#undef COMM_STATS_TX
+#undef COMM_STATS_RX
+#undef COMM_STATS_HIST
+#undef COMM_STAMP
+#undef COMM_WATCHDOG
+#undef COMM_TRACE
+#undef COMM_SNIFF
+#undef COMM_DEBUG
+#undef COMM_SEQ_SOURCES
+#undef COMM_CIPHER_ROUNDS
+#undef COMM_CIPHER_RESERVE
+#undef COMM_CIPHER_PEERS
+#undef COMM_RXQUEUE
+#undef COMM_WD_GAP
+#undef COMM_WD_LOST
+#undef COMM_TICK
+#undef COMM_TICK_HZ
+#undef COMM_RAM_MAX
+#undef COMM_ANY_STATS
+#undef COMM_T
+#undef COMM_TXSTAMP
+#undef COMM_ROR
+#undef COMM_ROL
+#undef COMM_HEADSIZE_
+#undef COMM_HEADSIZE
+#undef COMM_TAILSIZE
+#undef COMM_PACKETSIZE
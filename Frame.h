@@ -0,0 +1,46 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Frame format shared by Comm.cc and host tools (Host/FrameCodec).
+ *
+ * Plain C/C++, no AVR dependencies besides the CRC routine which
+ * is taken from avr-libc on the target. Frame with default Comm options:
+ * AA AA 2D D4 LENGTH CONTROL [SRC SEQ] DATA CRC_LO CRC_HI
+ * CONTROL low nibble is FRAME_CONTROL(LENGTH), high nibble is free
+ * (Config). SRC/SEQ are present with COMM_SEQ. CRC covers LENGTH..DATA;
+ * CRC over the whole packet including the CRC bytes is 0.
+ ********************/
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+
+/* Synchronization pattern sent before each packet; RFM12 FIFO
+ * starts filling after the last two bytes */
+#define FRAME_SYNCH		{0xAA, 0xAA, 0x2D, 0xD4}
+#define FRAME_SYNCHSIZE		4
+#define FRAME_SYNCWORD		0x2DD4
+
+/* CRC-CCITT (reflected, polynomial 0x8408) initial value */
+#define FRAME_CRCINIT		0xFFFF
+
+/* Control nibble for a given length */
+#define FRAME_CONTROL(Length)	((~(Length)) & 0x0F)
+
+#ifdef __AVR__
+#	include <util/crc16.h>
+#	define FrameCRCUpdate	_crc_ccitt_update
+#else
+/** CRC-CCITT update by one byte; same as avr-libc _crc_ccitt_update() */
+static inline uint16_t FrameCRCUpdate(uint16_t CRC, uint8_t Data)
+{
+	Data ^= (uint8_t)CRC;
+	Data ^= (uint8_t)(Data << 4);
+	return ((((uint16_t)Data << 8) | (CRC >> 8)) ^
+		(uint8_t)(Data >> 4) ^ ((uint16_t)Data << 3));
+}
+#endif /* __AVR__ */
+
+#endif /* _FRAME_H_ */
@@ -0,0 +1,96 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Frequency hopping over a list of channels.
+ *
+ * Requires RF.cc module included. Time is divided into slots; channel
+ * of each slot is taken from a pseudo-random sequence computed from
+ * the slot number and a network seed. Sequence is stateless, so nodes
+ * stay synchronized by sharing the slot number only (For e.g. in
+ * a beacon) and a node which missed some slots can jump in with Sync().
+ *
+ * Channels might be divided between several node groups; each group
+ * hops only over its own part of the list (channels i where
+ * i % Groups == Group), so groups never collide and work in parallel.
+ *
+ * Example:
+ * Hop::Init(NetSeed, MyGroup, 2);
+ * ...
+ * Hop::Next();			// At each slot boundary, Comm idle
+ * Hop::Sync(BeaconSlot);	// When slot number is received
+ ********************/
+
+/***
+ * Hopping configuration
+ ***/
+
+/* Channel list; F parameters of RF12_FQ_CMD (96-3903).
+ * At 433 band step of 1 is 2.5kHz; 0x00A0 = 400kHz */
+#define HOP_CHANNELS					\
+	0x0190, 0x0230, 0x02D0, 0x0370,			\
+	0x0410, 0x04B0, 0x0550, 0x05F0,			\
+	0x0690, 0x0730, 0x07D0, 0x0870
+
+/** Frequency hopping */
+namespace Hop {
+	/** Channel list in flash */
+	static const uint16_t Channels[] PROGMEM = { HOP_CHANNELS };
+	const uint8_t ChannelCount = sizeof(Channels) / sizeof(*Channels);
+
+	/** Hopping state */
+	static struct {
+		uint16_t Seed;		/**< Network seed */
+		uint16_t Slot;		/**< Current slot number */
+		uint8_t Group;		/**< Our group */
+		uint8_t Groups;		/**< Number of groups */
+		uint8_t Channel;	/**< Current channel index */
+	} State;
+
+	/** Channel index used in given slot */
+	static inline uint8_t Channel(uint16_t Slot)
+	{
+		/* 16 bit xorshift-multiply mix of slot and seed */
+		uint16_t x = Slot ^ State.Seed;
+		x ^= x >> 7;
+		x *= 0x2F4B;
+		x ^= x >> 9;
+		return (x % (ChannelCount / State.Groups)) * State.Groups + State.Group;
+	}
+
+	/** Retune RFM to the channel of current slot */
+	static inline void Tune(void)
+	{
+		uint8_t Ch = Channel(State.Slot);
+		if (Ch != State.Channel) {
+			State.Channel = Ch;
+			RF::SetFreq(pgm_read_word(&Channels[Ch]));
+		}
+	}
+
+	/** Initialize hopping and tune to channel of slot 0.
+	 * Groups must be between 1 and ChannelCount. */
+	static inline void Init(uint16_t Seed, uint8_t Group, uint8_t Groups)
+	{
+		State.Seed = Seed;
+		State.Group = Group;
+		State.Groups = Groups;
+		State.Slot = 0;
+		State.Channel = 0xFF;
+		Tune();
+	}
+
+	/** Go to the next slot */
+	static inline void Next(void)
+	{
+		State.Slot++;
+		Tune();
+	}
+
+	/** Synchronize with slot number received from other node */
+	static inline void Sync(uint16_t Slot)
+	{
+		State.Slot = Slot;
+		Tune();
+	}
+}
@@ -0,0 +1,229 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Portable frame encoder/decoder; see FrameCodec.h
+ ********************/
+
+#include <string.h>
+
+#include "FrameCodec.h"
+
+namespace FrameCodec {
+	/** Slicing-by-8 tables; Table[0] is the byte at a time one */
+	static uint16_t Table[8][256];
+
+	/** Fill tables from the reference update */
+	static bool TableInit(void)
+	{
+		unsigned int i, k;
+		for (i = 0; i < 256; i++)
+			Table[0][i] = FrameCRCUpdate(0, i);
+		for (k = 1; k < 8; k++)
+			for (i = 0; i < 256; i++)
+				Table[k][i] = (Table[k - 1][i] >> 8) ^
+					Table[0][Table[k - 1][i] & 0xFF];
+		return true;
+	}
+	static const bool TableReady = TableInit();
+
+	size_t HeadSize(const format_t &Format)
+	{
+		return 1 + (Format.Ctr ? 1 : 0) + (Format.Seq ? 2 : 0);
+	}
+
+	size_t Overhead(const format_t &Format)
+	{
+		return FRAME_SYNCHSIZE + HeadSize(Format) + (Format.CRC ? 2 : 0);
+	}
+
+	uint16_t CRCBytewise(const uint8_t *Data, size_t Length, uint16_t Init)
+	{
+		uint16_t C = Init;
+		while (Length--)
+			C = FrameCRCUpdate(C, *Data++);
+		return C;
+	}
+
+	uint16_t CRC(const uint8_t *Data, size_t Length, uint16_t Init)
+	{
+		uint32_t C = Init;
+		uint32_t A, B;
+
+		/* Reflected CRC: state is xored into the first two bytes */
+		while (Length >= 8) {
+			A = (uint32_t)Data[0] | (uint32_t)Data[1] << 8 |
+				(uint32_t)Data[2] << 16 | (uint32_t)Data[3] << 24;
+			B = (uint32_t)Data[4] | (uint32_t)Data[5] << 8 |
+				(uint32_t)Data[6] << 16 | (uint32_t)Data[7] << 24;
+			A ^= C;
+			C = Table[7][A & 0xFF] ^ Table[6][(A >> 8) & 0xFF] ^
+				Table[5][(A >> 16) & 0xFF] ^ Table[4][A >> 24] ^
+				Table[3][B & 0xFF] ^ Table[2][(B >> 8) & 0xFF] ^
+				Table[1][(B >> 16) & 0xFF] ^ Table[0][B >> 24];
+			Data += 8;
+			Length -= 8;
+		}
+		while (Length--)
+			C = (C >> 8) ^ Table[0][(C ^ *Data++) & 0xFF];
+		return C;
+	}
+
+	size_t Encode(const format_t &Format, const frame_t &Frame, uint8_t *Out)
+	{
+		static const uint8_t Synch[] = FRAME_SYNCH;
+		uint8_t *P = Out + FRAME_SYNCHSIZE;
+		uint16_t C;
+
+		if (Frame.Length == 0 || Frame.Length > Format.MaxMesg ||
+		    Frame.Length > 0xFF)
+			return 0;
+		memcpy(Out, Synch, FRAME_SYNCHSIZE);
+		*P++ = Frame.Length;
+		if (Format.Ctr)
+			*P++ = (Frame.Config << 4) | FRAME_CONTROL(Frame.Length);
+		if (Format.Seq) {
+			*P++ = Frame.Src;
+			*P++ = Frame.Seq;
+		}
+		memcpy(P, Frame.Data, Frame.Length);
+		P += Frame.Length;
+		if (Format.CRC) {
+			C = CRC(Out + FRAME_SYNCHSIZE, P - Out - FRAME_SYNCHSIZE);
+			*P++ = C & 0xFF;
+			*P++ = C >> 8;
+		}
+		return P - Out;
+	}
+
+	long Decode(const format_t &Format, const uint8_t *Data, size_t Length,
+		    frame_t *Frame, stats_t *Stats)
+	{
+		const size_t Head = HeadSize(Format);
+		size_t Size;
+		uint16_t Len;
+
+		if (Length < Head)
+			return 0;
+		Len = Data[0];
+		if (Format.Ctr && (Data[1] & 0x0F) != FRAME_CONTROL(Len)) {
+			if (Stats)
+				Stats->CtrErr++;
+			return -1;
+		}
+		if (Len == 0 || Len > Format.MaxMesg) {
+			if (Stats)
+				Stats->LenErr++;
+			return -1;
+		}
+		Size = Head + Len + (Format.CRC ? 2 : 0);
+		if (Length < Size)
+			return 0;
+		if (Format.CRC && CRC(Data, Size) != 0) {
+			if (Stats)
+				Stats->CRCErr++;
+			return -1;
+		}
+
+		Frame->Config = Format.Ctr ? Data[1] >> 4 : 0;
+		Frame->Src = Format.Seq ? Data[Head - 2] : 0;
+		Frame->Seq = Format.Seq ? Data[Head - 1] : 0;
+		Frame->Length = Len;
+		Frame->Data = Data + Head;
+		return Size;
+	}
+
+	Parser::Parser(const format_t &Format, handler_t Handler, void *Ctx)
+		: Format(Format), Handler(Handler), Ctx(Ctx)
+	{
+		memset(&S, 0, sizeof(S));
+		Reset();
+	}
+
+	void Parser::Reset(void)
+	{
+		Last = 0;
+		Gather = false;
+		Pending.clear();
+	}
+
+	void Parser::Scan(const uint8_t *Data, size_t Length)
+	{
+		const uint8_t *End = Data + Length;
+		const uint8_t *P = Data;
+		const uint8_t *D4;
+		frame_t Frame;
+		long Size;
+
+		while (P < End) {
+			/* Last byte of the synchronization word */
+			D4 = (const uint8_t *)memchr(P, FRAME_SYNCWORD & 0xFF, End - P);
+			if (!D4) {
+				Last = End[-1];
+				return;
+			}
+			if ((D4 == Data ? Last : D4[-1]) != FRAME_SYNCWORD >> 8) {
+				P = D4 + 1;
+				continue;
+			}
+			P = D4 + 1;
+
+			Size = Decode(Format, P, End - P, &Frame, &S);
+			if (Size > 0) {
+				S.Frames++;
+				Handler(Ctx, &Frame);
+				P += Size;
+			} else if (Size == 0) {
+				/* Continues in the next chunk */
+				Pending.assign(P, End);
+				Gather = true;
+				return;
+			}
+			/* Bad - hunt again right after the synchronization */
+		}
+		Last = End[-1];
+	}
+
+	void Parser::Feed(const uint8_t *Data, size_t Length)
+	{
+		std::vector<uint8_t> Rescan;
+		frame_t Frame;
+		size_t Want, Take;
+		long Size;
+
+		S.Bytes += Length;
+		while (Gather && Length) {
+			/* Header first, then the rest of the frame */
+			Want = HeadSize(Format);
+			if (Pending.size() >= Want && Pending[0] != 0)
+				Want += Pending[0] + (Format.CRC ? 2 : 0);
+			Take = Want > Pending.size() ? Want - Pending.size() : 1;
+			if (Take > Length)
+				Take = Length;
+			Pending.insert(Pending.end(), Data, Data + Take);
+			Data += Take;
+			Length -= Take;
+
+			Size = Decode(Format, Pending.data(), Pending.size(), &Frame, &S);
+			if (Size == 0)
+				continue;
+			Gather = false;
+			if (Size > 0) {
+				S.Frames++;
+				Handler(Ctx, &Frame);
+				Last = Pending.back();
+				Pending.clear();
+			} else {
+				/* Hunt in the gathered bytes; byte before
+				 * them was the end of synchronization */
+				Rescan.swap(Pending);
+				Pending.clear();
+				Last = FRAME_SYNCWORD & 0xFF;
+				/* Its tail might become another partial frame */
+				Scan(Rescan.data(), Rescan.size());
+			}
+		}
+		if (Length)
+			Scan(Data, Length);
+	}
+}
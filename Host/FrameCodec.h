@@ -0,0 +1,123 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Portable frame encoder/decoder for gateways and log tools.
+ *
+ * Frame definition (synchronization, control nibble, CRC) comes from
+ * ../Frame.h, the same one Comm.cc uses. Options of the header must
+ * match the ones firmware was built with (format_t). Encrypted frames
+ * (COMM_CIPHER) aren't supported.
+ *
+ * CRC is computed with slicing-by-8 (8 table lookups per 8 bytes).
+ * Parser takes the stream in chunks of any size; frames lying within
+ * one chunk are checked in place and passed without copying, only
+ * a frame crossing a chunk boundary is gathered in a buffer. After
+ * a bad header or CRC parsing resumes right after the synchronization
+ * word, so a frame hidden in garbage is still found.
+ *
+ * Build: g++ -O2 FrameCodec.cc YourTool.cc (see frame_bench.cc)
+ *
+ * Example:
+ * FrameCodec::Parser P(Format, Handler, Ctx);
+ * while ((Len = read(Fd, Buff, sizeof(Buff))) > 0)
+ *	P.Feed(Buff, Len);
+ ********************/
+
+#ifndef _FRAMECODEC_H_
+#define _FRAMECODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "../Frame.h"
+
+/** Host side frame codec */
+namespace FrameCodec {
+	/** Options of the packet header; as COMM_CTR, COMM_SEQ,
+	 * COMM_CRC and COMM_MAXMESG of the firmware */
+	typedef struct {
+		bool Ctr;
+		bool Seq;
+		bool CRC;
+		uint16_t MaxMesg;
+	} format_t;
+
+	/** Comm.cc defaults */
+	const format_t Default = {true, false, true, 256};
+
+	/** Decoded frame (or frame to encode) */
+	typedef struct {
+		uint8_t Config;		/**< Control byte high nibble */
+		uint8_t Src, Seq;	/**< With format_t.Seq */
+		uint16_t Length;	/**< Body length */
+		const uint8_t *Data;	/**< Body; valid during the handler only */
+	} frame_t;
+
+	/** Parser statistics */
+	typedef struct {
+		uint64_t Bytes;
+		uint64_t Frames;
+		uint64_t LenErr;	/**< Length out of range */
+		uint64_t CtrErr;	/**< Control nibble mismatch */
+		uint64_t CRCErr;
+	} stats_t;
+
+	/** Called for each correct frame */
+	typedef void (*handler_t)(void *Ctx, const frame_t *Frame);
+
+	/** Header size without synchronization */
+	size_t HeadSize(const format_t &Format);
+
+	/** Bytes added to the body (synchronization, header, CRC) */
+	size_t Overhead(const format_t &Format);
+
+	/** CRC-CCITT of Length bytes; slicing-by-8 */
+	uint16_t CRC(const uint8_t *Data, size_t Length,
+		     uint16_t Init = FRAME_CRCINIT);
+
+	/** Byte at a time CRC; reference for CRC() */
+	uint16_t CRCBytewise(const uint8_t *Data, size_t Length,
+			     uint16_t Init = FRAME_CRCINIT);
+
+	/** Write whole frame (synchronization included) into Out, which
+	 * must hold Overhead() + Length bytes. Returns its size or 0 if
+	 * the length is out of range. */
+	size_t Encode(const format_t &Format, const frame_t &Frame, uint8_t *Out);
+
+	/** Check one packet starting after the synchronization word;
+	 * Length - bytes available. Returns packet size if it's correct
+	 * (Frame filled), 0 if more bytes are needed, -1 if it's bad. */
+	long Decode(const format_t &Format, const uint8_t *Data, size_t Length,
+		    frame_t *Frame, stats_t *Stats = NULL);
+
+	/** Streaming parser */
+	class Parser {
+	public:
+		Parser(const format_t &Format, handler_t Handler, void *Ctx);
+
+		/** Parse next chunk of the stream */
+		void Feed(const uint8_t *Data, size_t Length);
+
+		/** Forget partial frame (For e.g. input switched) */
+		void Reset(void);
+
+		const stats_t &Stats(void) const { return S; }
+
+	private:
+		/** Hunt for synchronization and decode frames in a chunk */
+		void Scan(const uint8_t *Data, size_t Length);
+
+		format_t Format;
+		handler_t Handler;
+		void *Ctx;
+		stats_t S;
+
+		uint8_t Last;			/* Last byte while hunting */
+		bool Gather;			/* Frame crosses chunks */
+		std::vector<uint8_t> Pending;	/* Its bytes so far */
+	};
+}
+
+#endif /* _FRAMECODEC_H_ */
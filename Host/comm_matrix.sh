@@ -0,0 +1,137 @@
+#!/bin/sh
+# (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+# License: GPLv3+ (See Docs/LICENSE)
+#
+# Builds RF.cc + Comm.cc with avr-g++ -Wall for a list of COMM_*
+# option combinations and prints the RAM taken by Comm::State of each.
+# The last build adds a second instance after the primary one, which
+# must get the default options back (see "Comm functionality
+# configuration" in Comm.cc).
+# Usage: comm_matrix.sh [-e] [MCU [F_CPU]]
+#   -e - treat warnings as errors
+# LCD/Util modules of the application are only declared. Functions
+# not called by the test unit are fine, so -Wunused-function is off.
+# Exit status is the number of failed builds.
+
+STRICT=0
+if [ "$1" = "-e" ]; then
+	STRICT=1
+	shift
+fi
+MCU=${1:-atmega644p}
+CPU=${2:-8000000}
+CXX=${CXX:-avr-g++}
+NM=${NM:-avr-nm}
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d) || exit 255
+trap 'rm -rf "$TMP"' EXIT
+
+# One combination per line; defaults are built first
+MATRIX="
+COMM_TX=0
+COMM_RX=0
+COMM_CRC=0
+COMM_CTR=0
+COMM_CRC=0 COMM_CTR=0
+COMM_TXSG=0
+COMM_TXBUFF=0
+COMM_SHARED=1
+COMM_SEQ=1
+COMM_SEQ=1 COMM_TXRETRY=0 COMM_RXRETRY=0
+COMM_CIPHER=1
+COMM_CIPHER=1 COMM_SEQ=1 COMM_TXBUFF=0
+COMM_CIPHER=1 COMM_TX=0
+COMM_RXPOOL=1
+COMM_RXPOOL=1 COMM_CIPHER=1 COMM_SNIFF=256
+COMM_QUALITY=0
+COMM_STATS_TX=0 COMM_STATS_RX=0 COMM_TESTCASES=0
+COMM_STATS_HIST=1 COMM_STAMP=1
+COMM_WATCHDOG=1
+COMM_WATCHDOG=1 COMM_RXPOOL=1
+COMM_TRACE=64
+COMM_SNIFF=512
+COMM_SNIFF=512 COMM_TRACE=32 COMM_DEBUG=1
+COMM_TX=0 COMM_SNIFF=1024 COMM_WATCHDOG=1
+COMM_RX=0 COMM_TXBUFF=0 COMM_STATS_TX=0
+COMM_MAXMESG=64 COMM_RAM_MAX=1024
+"
+
+# Second instance, included after the primary one
+SECOND='
+#define RF_NS		RF2
+#define RF_SS		PB3
+#define RF_IRQ_PIN	PIND
+#define RF_IRQ_PORT	PORTD
+#define RF_IRQ_DDR	DDRD
+#define RF_IRQ_MASK	(1<<PD3)
+#define RF_IRQ_vect	INT1_vect
+#define RF_IRQ_CONFIG()	RF_IRQ_CONFIG_(1)
+#define RF_IRQ_ON()	RF_IRQ_ON_(1)
+#define RF_IRQ_OFF()	RF_IRQ_OFF_(1)
+#define COMM_NS		Comm2
+#define COMM_MAXMESG	64
+#define COMM_TESTCASES	0
+#define COMM_TX		0
+#include "RF.cc"
+#include "Comm.cc"
+'
+
+# Parts of the application used by RF.cc and testcases
+APP='
+namespace LCD {
+	struct state_t { uint8_t x, y; };
+	extern state_t State;
+	void Refresh(void);
+	void ClearScreen(void);
+	void GotoXY(uint8_t x, uint8_t y);
+}
+namespace Util {
+	void SDelay(uint8_t s);
+}
+'
+
+# Build Comm.cc with options $1; $2 - code appended after the primary
+Build()
+{
+	{
+		printf '#include <avr/io.h>\n#include <avr/interrupt.h>\n'
+		printf '#include <stdio.h>\n#include <string.h>\n%s\n' "$APP"
+		printf '#include "RF.cc"\n#include "Comm.cc"\n%s\n' "$2"
+	} > "$TMP/matrix.cc"
+
+	FLAGS="-mmcu=$MCU -DF_CPU=${CPU}UL -Os -Wall -Wno-unused-function"
+	for Opt in $1; do
+		FLAGS="$FLAGS -D$Opt"
+	done
+	[ $STRICT = 1 ] && FLAGS="$FLAGS -Werror"
+
+	if ! $CXX $FLAGS -iquote "$SRC" -c -o "$TMP/matrix.o" \
+	     "$TMP/matrix.cc" > "$TMP/log" 2>&1; then
+		printf 'FAIL  %s\n' "${1:-(defaults)}"
+		sed 's/^/      /' "$TMP/log"
+		return 1
+	fi
+	Size=$($NM -C -S -t d "$TMP/matrix.o" | grep '::State$' |
+	       awk '{ printf "%s%d", Sep, $2; Sep = "+" }')
+	if [ -s "$TMP/log" ]; then
+		printf 'WARN  %-8s %s\n' "$Size" "${1:-(defaults)}"
+		sed 's/^/      /' "$TMP/log"
+	else
+		printf 'ok    %-8s %s\n' "$Size" "${1:-(defaults)}"
+	fi
+	return 0
+}
+
+Failed=0
+printf 'Comm.cc build matrix: %s, F_CPU %s; State size [bytes]\n' "$MCU" "$CPU"
+Build "" "" || Failed=$((Failed + 1))
+while read -r Line; do
+	[ -n "$Line" ] || continue
+	Build "$Line" "" || Failed=$((Failed + 1))
+done <<END
+$MATRIX
+END
+Build "COMM_CIPHER=1 COMM_SNIFF=256" "$SECOND" || Failed=$((Failed + 1))
+
+printf '%d failed\n' $Failed
+exit $Failed
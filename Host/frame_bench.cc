@@ -0,0 +1,140 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: FrameCodec benchmark.
+ *
+ * Builds a capture of random frames (body 8-64 bytes) mixed with noise
+ * and broken frames, then measures CRC speed (byte at a time vs
+ * slicing-by-8) and parser throughput with the capture fed in chunks.
+ * Decoded frames are compared with the sent ones, so a wrong result
+ * is reported instead of a fast one.
+ *
+ * Build: g++ -O2 -o frame_bench FrameCodec.cc frame_bench.cc
+ * Usage: frame_bench [FRAMES] [CHUNK]
+ ********************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FrameCodec.h"
+
+/** Expected body of each good frame; kept in order */
+typedef struct {
+	std::vector<uint32_t> Sum;	/* Checksum of each good body */
+	size_t Next;
+	size_t Wrong;
+	uint32_t Sink;
+} check_t;
+
+/** Results stored here aren't optimized away */
+static volatile uint32_t Keep;
+
+static double Now(void)
+{
+	struct timespec T;
+	clock_gettime(CLOCK_MONOTONIC, &T);
+	return T.tv_sec + T.tv_nsec * 1e-9;
+}
+
+static uint32_t Checksum(const uint8_t *Data, size_t Length)
+{
+	uint32_t Sum = Length;
+	while (Length--)
+		Sum = Sum * 31 + *Data++;
+	return Sum;
+}
+
+static void Handler(void *Ctx, const FrameCodec::frame_t *Frame)
+{
+	check_t *C = (check_t *)Ctx;
+	const uint32_t Sum = Checksum(Frame->Data, Frame->Length);
+	if (C->Next >= C->Sum.size() || C->Sum[C->Next] != Sum)
+		C->Wrong++;
+	C->Next++;
+	C->Sink += Sum;
+}
+
+int main(int argc, char **argv)
+{
+	const size_t Frames = argc > 1 ? atol(argv[1]) : 2000000;
+	const size_t Chunk = argc > 2 ? atol(argv[2]) : 65536;
+	const FrameCodec::format_t Format = FrameCodec::Default;
+	std::vector<uint8_t> Capture;
+	uint8_t Body[256], Out[512];
+	FrameCodec::frame_t F;
+	check_t Check;
+	size_t i, Size, Pos;
+	double T;
+	uint32_t Sink = 0;
+	int Rounds;
+
+	srand(1);
+	Check.Next = Check.Wrong = 0;
+	Check.Sink = 0;
+	Capture.reserve(Frames * 48);
+	for (i = 0; i < Frames; i++) {
+		F.Length = 8 + rand() % 57;
+		for (Size = 0; Size < F.Length; Size++)
+			Body[Size] = rand();
+		F.Data = Body;
+		F.Config = i & 0x0F;
+		Size = FrameCodec::Encode(Format, F, Out);
+		if (i % 64 == 63) {
+			/* Broken frame */
+			Out[Size / 2] ^= 0x10;
+		} else {
+			Check.Sum.push_back(Checksum(Body, F.Length));
+		}
+		Capture.insert(Capture.end(), Out, Out + Size);
+		if (i % 16 == 0) {
+			/* Noise between frames */
+			for (Size = rand() % 8; Size; Size--)
+				Capture.push_back(rand());
+		}
+	}
+
+	/* CRC: byte at a time and slicing-by-8 over the whole capture */
+	for (i = 0; i < Capture.size() && FrameCodec::CRC(&Capture[0], i) ==
+		     FrameCodec::CRCBytewise(&Capture[0], i); i += 1 + i / 8);
+	if (i < Capture.size()) {
+		printf("CRC mismatch at %zu bytes\n", i);
+		return 1;
+	}
+	T = Now();
+	for (Rounds = 0; Rounds < 3; Rounds++)
+		Sink += FrameCodec::CRCBytewise(&Capture[0], Capture.size());
+	T = Now() - T;
+	printf("CRC bytewise:  %8.1f MB/s\n", 3 * Capture.size() / T / 1e6);
+	T = Now();
+	for (Rounds = 0; Rounds < 3; Rounds++)
+		Sink += FrameCodec::CRC(&Capture[0], Capture.size());
+	T = Now() - T;
+	printf("CRC slicing-8: %8.1f MB/s\n", 3 * Capture.size() / T / 1e6);
+
+	/* Parser */
+	FrameCodec::Parser P(Format, Handler, &Check);
+	T = Now();
+	for (Pos = 0; Pos < Capture.size(); Pos += Size) {
+		Size = Capture.size() - Pos < Chunk ? Capture.size() - Pos : Chunk;
+		P.Feed(&Capture[Pos], Size);
+	}
+	T = Now() - T;
+
+	const FrameCodec::stats_t &S = P.Stats();
+	printf("Parser: %llu frames in %.3f s - %.2f Mframes/s, %.1f MB/s "
+	       "(chunk %zu)\n", (unsigned long long)S.Frames, T,
+	       S.Frames / T / 1e6, Capture.size() / T / 1e6, Chunk);
+	printf("Errors: CRC %llu, control %llu, length %llu\n",
+	       (unsigned long long)S.CRCErr, (unsigned long long)S.CtrErr,
+	       (unsigned long long)S.LenErr);
+	if (Check.Wrong || Check.Next != Check.Sum.size()) {
+		printf("FAILED: %zu wrong, %zu of %zu frames decoded\n",
+		       Check.Wrong, Check.Next, Check.Sum.size());
+		return 1;
+	}
+	Keep = Sink + Check.Sink;
+	return 0;
+}
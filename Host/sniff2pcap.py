@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+# (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+# License: GPLv3+ (See Docs/LICENSE)
+#
+# Converts the Sniff.cc capture stream into a pcap file.
+# Usage: sniff2pcap.py [--tick-hz HZ] [--live] IN OUT.pcap
+# IN is a dump of the UART stream or a serial port already set up
+# (stty) with --live. Records are found by their 0xA5 mark, so the
+# stream may start in the middle of a record.
+#
+# Each pcap packet (link type USER0) carries a 4 byte pseudo header:
+# event, flags (bit 0 - truncated), status word (little endian),
+# followed by the raw frame bytes as received (length, control, ...).
+# Reports of dropped frames are printed on stderr.
+#
+# Capture ticks are 16 bit. With --live the host clock resolves timer
+# wrap-arounds; otherwise records are assumed to be less than one timer
+# period apart.
+
+import struct
+import sys
+import time
+
+# Keep in sync with Comm::TraceEvent
+EVENTS = [
+    "NONE", "IDLE", "RXINIT", "TXINIT", "SYNC", "HEAD", "HEADERR",
+    "RXEND", "CRCERR", "FFOV", "RGUR", "TXEND", "ABORT",
+    "DUP", "AUTHERR", "REPLAY",
+]
+EV_NONE = 0
+EV_LAST = len(EVENTS) - 1
+
+MARK = 0xA5
+HEAD = struct.Struct("<BBHHH")  # Mark, event, count, tick, status
+MAXCOUNT = 1024                 # Longer records are taken as garbage
+LINKTYPE_USER0 = 147
+
+
+class Clock:
+    """Extends 16 bit ticks into seconds"""
+
+    def __init__(self, hz, live):
+        self.hz = hz
+        self.live = live
+        self.ticks = 0
+        self.last = None
+        self.host = None
+        self.start = None
+
+    def stamp(self, tick):
+        now = time.time()
+        if self.last is not None:
+            delta = (tick - self.last) & 0xFFFF
+            if self.live:
+                # Whole timer periods which passed on the host
+                periods = round(((now - self.host) * self.hz - delta)
+                                / 0x10000)
+                delta += max(periods, 0) * 0x10000
+            self.ticks += delta
+        else:
+            self.start = now
+        self.last = tick
+        self.host = now
+        return self.start + self.ticks / self.hz
+
+
+def records(inp):
+    """Yields (event, flags, tick, status, data) from the stream"""
+    buff = bytearray()
+    while True:
+        chunk = inp.read(256)
+        if not chunk:
+            return
+        buff += chunk
+        while True:
+            start = buff.find(MARK)
+            if start < 0:
+                del buff[:]
+                break
+            del buff[:start]
+            if len(buff) < HEAD.size:
+                break
+            mark, event, count, tick, status = HEAD.unpack_from(buff)
+            if (event & 0x7F) > EV_LAST or count > MAXCOUNT:
+                # Not a record; resynchronize on the next mark
+                del buff[:1]
+                continue
+            if len(buff) < HEAD.size + count:
+                break
+            data = bytes(buff[HEAD.size:HEAD.size + count])
+            del buff[:HEAD.size + count]
+            yield event & 0x7F, event >> 7, tick, status, data
+
+
+def main():
+    hz = 1000000.0
+    live = False
+    args = sys.argv[1:]
+    while args and args[0].startswith("--"):
+        opt = args.pop(0)
+        if opt == "--tick-hz" and args:
+            hz = float(args.pop(0))
+        elif opt == "--live":
+            live = True
+        else:
+            args = []
+            break
+    if len(args) != 2:
+        sys.exit("Usage: sniff2pcap.py [--tick-hz HZ] [--live] IN OUT.pcap")
+
+    clock = Clock(hz, live)
+    frames = lost = 0
+    with open(args[0], "rb", buffering=0) as inp, open(args[1], "wb") as out:
+        out.write(struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0,
+                              65535, LINKTYPE_USER0))
+        try:
+            for event, trunc, tick, status, data in records(inp):
+                if event == EV_NONE:
+                    # Tick field holds the count of dropped frames
+                    lost += tick
+                    print("%u frames lost" % tick, file=sys.stderr)
+                    continue
+                stamp = clock.stamp(tick)
+                pkt = struct.pack("<BBH", event, trunc, status) + data
+                out.write(struct.pack("<IIII", int(stamp),
+                                      int(stamp % 1 * 1000000),
+                                      len(pkt), len(pkt)))
+                out.write(pkt)
+                if live:
+                    out.flush()
+                frames += 1
+        except KeyboardInterrupt:
+            pass
+    print("%u frames, %u lost" % (frames, lost), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
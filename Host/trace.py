@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+# (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+# License: GPLv3+ (See Docs/LICENSE)
+#
+# Decodes Comm::TraceDump() output into a timeline.
+# Usage: trace.py [--tick-us US] < dump.txt
+# Lines not starting with "T " are ignored, so a whole UART log
+# might be passed.
+
+import sys
+
+# Keep in sync with Comm::TraceEvent
+EVENTS = [
+    "NONE", "IDLE", "RXINIT", "TXINIT", "SYNC", "HEAD", "HEADERR",
+    "RXEND", "CRCERR", "FFOV", "RGUR", "TXEND", "ABORT",
+    "DUP", "AUTHERR", "REPLAY",
+]
+
+STATUS_BITS = [
+    (15, "RGIT/FFIT"), (14, "POR"), (13, "RGUR/FFOV"), (12, "WKUP"),
+    (11, "EXT"), (10, "LBD"), (9, "FFEM"), (8, "RSSI/ATS"),
+    (7, "DQD"), (6, "CRL"), (5, "ATGL"),
+]
+
+
+def status_str(sw):
+    bits = [name for bit, name in STATUS_BITS if sw & (1 << bit)]
+    offs = sw & 0x1F
+    if offs & 0x10:
+        offs -= 0x20
+    return " ".join(bits) + " OFFS=%d" % offs
+
+
+def main():
+    tick_us = 1.0
+    args = sys.argv[1:]
+    if len(args) == 2 and args[0] == "--tick-us":
+        tick_us = float(args[1])
+    elif args:
+        sys.exit("Usage: trace.py [--tick-us US] < dump.txt")
+
+    time = 0
+    last = None
+    for line in sys.stdin:
+        part = line.split()
+        if len(part) != 4 or part[0] != "T":
+            continue
+        try:
+            ev, sw, tick = (int(x, 16) for x in part[1:])
+        except ValueError:
+            continue
+        if last is not None:
+            # 16 bit timer wraps around
+            time += (tick - last) & 0xFFFF
+        last = tick
+        name = EVENTS[ev] if ev < len(EVENTS) else "EV%02X" % ev
+        print("%12.1f us  %-8s %04X  %s" %
+              (time * tick_us, name, sw, status_str(sw)))
+
+
+if __name__ == "__main__":
+    main()
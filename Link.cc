@@ -0,0 +1,76 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Running link quality estimate per peer.
+ *
+ * Requires Comm.cc module included with COMM_QUALITY. Uses quality stored
+ * with each received packet (RSSI/DQD counts and AFC offset) and keeps
+ * exponentially weighted averages for each peer:
+ * - PER - packet error rate; 0 - no losses, 0xFFFF - everything lost,
+ * - Signal - signal score 0-255 from RSSI and DQD,
+ * - Offset - AFC offset in 1/8 of AFC step.
+ * Routing, rate and power decisions might use them without any SPI traffic.
+ *
+ * Example:
+ * Link::Received(Peer, &Pkt->Quality, Length);	// Frame from Peer received
+ * Link::Lost(Peer);				// Expected frame missing
+ ********************/
+
+/***
+ * Link quality configuration
+ ***/
+
+/* Number of peers tracked */
+#define LINK_PEERS	8
+
+/* Averaging weight: new sample has weight 1/(2^LINK_SHIFT) */
+#define LINK_SHIFT	3
+
+/** Link quality estimator */
+namespace Link {
+	/** Per peer link quality */
+	typedef struct {
+		uint16_t PER;		/**< Averaged packet error rate */
+		uint8_t Signal;		/**< Averaged signal score */
+		int8_t Offset;		/**< Averaged AFC offset * 8 */
+		Comm::quality_t Last;	/**< Quality of last packet */
+	} peer_t;
+
+	/** Link estimator state */
+	static struct {
+		peer_t Peer[LINK_PEERS];
+	} State;
+
+	/** Signal score of one packet (0-255); half from RSSI, half from DQD */
+	static inline uint8_t Score(const Comm::quality_t *Q, Comm::len_t Length)
+	{
+		const uint16_t Bytes = Comm::PacketSize + Length;
+		return (uint8_t)(((uint32_t)Q->RSSI * 128 + (uint32_t)Q->DQD * 127)
+				 / Bytes);
+	}
+
+	/** Packet from peer received correctly */
+	static void Received(uint8_t Peer, const Comm::quality_t *Q, Comm::len_t Length)
+	{
+		peer_t *P = &State.Peer[Peer];
+		P->PER -= P->PER >> LINK_SHIFT;
+		P->Signal = P->Signal - (P->Signal >> LINK_SHIFT) +
+			(Score(Q, Length) >> LINK_SHIFT);
+		P->Offset = P->Offset - (P->Offset >> LINK_SHIFT) + Q->Offset;
+		P->Last = *Q;
+	}
+
+	/** Packet from peer lost (timeout, missing ack, CRC error) */
+	static inline void Lost(uint8_t Peer)
+	{
+		peer_t *P = &State.Peer[Peer];
+		P->PER = P->PER - (P->PER >> LINK_SHIFT) + (0xFFFF >> LINK_SHIFT);
+	}
+
+	/** Return link quality of peer */
+	static inline const peer_t *Get(uint8_t Peer)
+	{
+		return &State.Peer[Peer];
+	}
+}
@@ -0,0 +1,322 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: LZ compression of frame bodies (For e.g. UART bridge).
+ *
+ * Requires Comm.cc module included (TX with TXBUFF for Send()).
+ * Each frame is compressed alone - a lost frame doesn't break the next
+ * ones - so the window is the frame itself and only a small hash table
+ * (LZ_HASH bytes) is needed. ASCII logs and NMEA sentences repeat field
+ * names, separators and digits, which gives matches even within one frame.
+ * Frame body looks like this:
+ * MODE DATA
+ * MODE is LZ_RAW when data didn't compress, LZ_PACKED otherwise.
+ * Packed data is a list of tokens:
+ * 0LLLLLLL             - L + 1 literal bytes follow
+ * 1LLLLLLL OFFSET      - copy L + 3 bytes from OFFSET bytes back
+ *
+ * Input size, output size and time spent packing are counted, so
+ * Report() shows the ratio and cycles per byte on the target.
+ *
+ * Example (see Testcase_UART_TX/RX):
+ * Lz::Send(Raw, RawLength);		// Instead of TXGetBuff/TXInit
+ * ...
+ * Buff = Comm::RXGetPacket(&Length);
+ * RawLength = Lz::Receive(Buff, Length, Raw);
+ ********************/
+
+/***
+ * Compression configuration
+ ***/
+
+/* Hash table size (power of 2); bigger finds more matches */
+#define LZ_HASH		128
+
+/* Longest raw input; compressed frame might be one byte longer */
+#define LZ_MAXRAW	254
+
+/* Compile testcases (need Comm testcases and stdio on UART) */
+#define LZ_TESTCASES	COMM1_TESTCASES
+
+/* CPU cycles per COMM_TICK tick */
+#define LZ_TICK_CYCLES	(F_CPU / Comm::TickHz)
+
+/** Frame compression */
+namespace Lz {
+	/** Frame modes */
+	enum {
+		LZ_RAW = 0,
+		LZ_PACKED = 1,
+	};
+
+	/** Longest literal run and match */
+	const uint8_t MaxRun = 128;
+	const uint8_t MaxMatch = 127 + 3;
+
+	/** Compression state */
+	static struct {
+		uint8_t Hash[LZ_HASH];	/* Position + 1 of last 3 bytes with hash */
+
+		/* Statistics */
+		uint32_t In, Out;	/* Raw and sent body bytes */
+		uint32_t Ticks;		/* Time spent in Pack() */
+		uint8_t Last;		/* Body length of the last frame sent */
+	} State;
+
+	/** Hash of three bytes */
+	static inline uint8_t Hash(const uint8_t *P)
+	{
+		return ((P[0] << 4) ^ (P[1] << 2) ^ P[2]) & (LZ_HASH - 1);
+	}
+
+	/** Emit literal run; returns new output position or 0 if
+	 * it exceeds Limit */
+	static inline uint16_t Literals(const uint8_t *In, uint8_t Count,
+					uint8_t *Out, uint16_t Pos, uint16_t Limit)
+	{
+		uint8_t Run;
+		while (Count) {
+			Run = Count > MaxRun ? MaxRun : Count;
+			if (Pos + 1 + Run > Limit)
+				return 0;
+			Out[Pos++] = Run - 1;
+			memcpy(Out + Pos, In, Run);
+			Pos += Run;
+			In += Run;
+			Count -= Run;
+		}
+		return Pos;
+	}
+
+	/**
+	 * \brief
+	 *   Compress Length bytes. Output is written only while it's
+	 *   shorter than the input.
+	 *
+	 * \return Packed length or 0 if it wouldn't be shorter.
+	 */
+	static uint8_t Pack(const uint8_t *In, uint8_t Length, uint8_t *Out)
+	{
+		const uint16_t Limit = Length - 1;
+		uint16_t Pos = 0;
+		uint8_t i = 0, Lit = 0, Ref, Len, h;
+
+		if (Length < 4)
+			return 0;
+		memset(State.Hash, 0, sizeof(State.Hash));
+		while (i + 2 < Length) {
+			h = Hash(In + i);
+			Ref = State.Hash[h];
+			State.Hash[h] = i + 1;
+			if (!Ref || memcmp(In + --Ref, In + i, 3) != 0) {
+				i++;
+				continue;
+			}
+
+			/* Extend match */
+			for (Len = 3; i + Len < Length && Len < MaxMatch &&
+				     In[Ref + Len] == In[i + Len]; Len++);
+
+			if (i > Lit &&
+			    !(Pos = Literals(In + Lit, i - Lit, Out, Pos, Limit)))
+				return 0;
+			if (Pos + 2 > Limit)
+				return 0;
+			Out[Pos++] = 0x80 | (Len - 3);
+			Out[Pos++] = i - Ref;
+			/* Positions inside the match are candidates too */
+			for (Len += i++; i < Len && i + 2 < Length; i++)
+				State.Hash[Hash(In + i)] = i + 1;
+			i = Len;
+			Lit = i;
+		}
+		if (Length > Lit &&
+		    !(Pos = Literals(In + Lit, Length - Lit, Out, Pos, Limit)))
+			return 0;
+		return Pos;
+	}
+
+	/** Decompress; returns unpacked length or -1 if data is malformed
+	 * or doesn't fit in Max bytes */
+	static int16_t Unpack(const uint8_t *In, uint8_t Length,
+			      uint8_t *Out, uint16_t Max)
+	{
+		const uint8_t *End = In + Length;
+		uint16_t Pos = 0;
+		uint8_t Token, Len, Off;
+
+		while (In < End) {
+			Token = *In++;
+			if (!(Token & 0x80)) {
+				Len = Token + 1;
+				if (In + Len > End || Pos + Len > Max)
+					return -1;
+				memcpy(Out + Pos, In, Len);
+				In += Len;
+			} else {
+				Len = (Token & 0x7F) + 3;
+				if (In == End)
+					return -1;
+				Off = *In++;
+				if (Off == 0 || Off > Pos || Pos + Len > Max)
+					return -1;
+				/* Byte by byte - source may overlap */
+				for (Token = 0; Token < Len; Token++)
+					Out[Pos + Token] = Out[Pos - Off + Token];
+			}
+			Pos += Len;
+		}
+		return Pos;
+	}
+
+#if COMM1_TX && COMM1_TXBUFF
+	/** Compress one frame into Comm TX buffer and send it (raw if it
+	 * doesn't compress). Waits for the previous frame. Returns 0 if
+	 * Comm refused to send it (see Comm::TXInit()). */
+	static char SendFrame(const uint8_t *Raw, uint8_t Length)
+	{
+		uint8_t *Buff;
+		uint16_t Start;
+		uint8_t Packed;
+
+		Comm::TXWait();
+		Buff = (uint8_t *)Comm::TXGetBuff();
+		Start = Comm::Tick();
+		Packed = Pack(Raw, Length, Buff + 1);
+		State.Ticks += (uint16_t)(Comm::Tick() - Start);
+		if (Packed) {
+			Buff[0] = LZ_PACKED;
+		} else {
+			Buff[0] = LZ_RAW;
+			memcpy(Buff + 1, Raw, Length);
+			Packed = Length;
+		}
+		State.Last = Packed + 1;
+		if (!Comm::TXInit(Packed + 1))
+			return 0;
+		State.In += Length;
+		State.Out += Packed + 1;
+		return 1;
+	}
+
+	/** Send data; split into frames of at most LZ_MAXRAW raw bytes,
+	 * so the mode byte always fits in the frame length. Returns 0
+	 * (rest of data not sent) if a frame was refused. */
+	static char Send(const uint8_t *Raw, uint16_t Length)
+	{
+		uint8_t Part;
+		while (Length) {
+			Part = Length > LZ_MAXRAW ? LZ_MAXRAW : Length;
+			if (!SendFrame(Raw, Part))
+				return 0;
+			Raw += Part;
+			Length -= Part;
+		}
+		return 1;
+	}
+#endif /* TX */
+
+	/** Restore raw data of received frame into Raw (LZ_MAXRAW bytes);
+	 * returns its length or -1 if the frame is malformed */
+	static int16_t Receive(const char *Buff, Comm::len_t Length, uint8_t *Raw)
+	{
+		if (Length < 1)
+			return -1;
+		Length--;
+		switch (*Buff) {
+		case LZ_RAW:
+			if (Length > LZ_MAXRAW)
+				return -1;
+			memcpy(Raw, Buff + 1, Length);
+			return Length;
+		case LZ_PACKED:
+			return Unpack((const uint8_t *)Buff + 1, Length, Raw, LZ_MAXRAW);
+		default:
+			return -1;
+		}
+	}
+
+	/** Print compression ratio and packing cost */
+	static void Report(void)
+	{
+		if (!State.In)
+			return;
+		printf("LZ %lu->%lu (%u%%) %lu cyc/B\n",
+		       State.In, State.Out,
+		       (unsigned int)(State.Out * 100 / State.In),
+		       State.Ticks * LZ_TICK_CYCLES / State.In);
+	}
+
+#if LZ_TESTCASES
+#if COMM1_TX && COMM1_TXBUFF
+	/** Send stdin like Comm::Testcase_UART_TX, compressed; each sent
+	 * frame is unpacked again from the TX buffer and compared */
+	static inline void Testcase_UART_TX(void)
+	{
+		static uint8_t Raw[255], Check[LZ_MAXRAW];
+		const uint8_t *Buff;
+		uint16_t Length, Pos;
+		uint8_t Part;
+		int i;
+
+		Comm::Init();
+		sei();
+		for (;;) {
+			Length = 0;
+			while (Length < sizeof(Raw)) {
+				i = getchar();
+				if (i == -1) {
+					if (Length == 0)
+						continue;
+					break;
+				}
+				Raw[Length++] = (uint8_t)i;
+			}
+
+			/* Send() with a round trip check of each frame */
+			for (Pos = 0; Pos < Length; Pos += Part) {
+				Part = Length - Pos > LZ_MAXRAW ? LZ_MAXRAW : Length - Pos;
+				if (!Send(Raw + Pos, Part)) {
+					printf("LZ: TX refused\n");
+					break;
+				}
+				Buff = (const uint8_t *)Comm::TXGetBuff();
+				if (Receive((const char *)Buff, State.Last, Check) != Part ||
+				    memcmp(Check, Raw + Pos, Part) != 0)
+					printf("LZ: round trip failed\n");
+			}
+			Report();
+		}
+	}
+#endif /* TX */
+
+#if COMM1_RX && !COMM1_RXPOOL
+	/** Receive frames sent by Testcase_UART_TX and print raw data */
+	static inline void Testcase_UART_RX(void)
+	{
+		static uint8_t Raw[LZ_MAXRAW];
+		const char *Buff;
+		Comm::len_t Length;
+		int16_t RawLength, i;
+
+		Comm::Init();
+		sei();
+		for (;;) {
+			Comm::RXInit();
+			Comm::RXWait();
+			Buff = Comm::RXGetPacket(&Length);
+			if (!Length)
+				continue;
+			RawLength = Receive(Buff, Length, Raw);
+			if (RawLength < 0) {
+				printf("LZ: malformed frame\n");
+				continue;
+			}
+			for (i = 0; i < RawLength; i++)
+				putchar(Raw[i]);
+		}
+	}
+#endif /* RX */
+#endif /* TESTCASES */
+}
@@ -0,0 +1,96 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Closed-loop TX power control per peer.
+ *
+ * Requires RF.cc, Comm.cc and Link.cc modules included. Receiver puts
+ * a margin byte (signal score of our last packet - Power::Margin()) into
+ * its ack or beacon. Sender passes it to Power::Feedback() and gets
+ * the lowest power step which still keeps the signal above POWER_LOW
+ * and PER (as estimated by Link) below POWER_PER.
+ * Only TX control register is rewritten, between frames.
+ *
+ * Example:
+ * Power::Use(Peer);				// Before TX to Peer
+ * ... send, receive ack with margin byte ...
+ * Power::Feedback(Peer, AckMargin);
+ *
+ * Receiver side:
+ * Ack[0] = Power::Margin(&Pkt->Quality, Length);
+ ********************/
+
+/***
+ * Power control configuration
+ ***/
+
+/* Number of peers tracked (shares peer numbers with Link) */
+#define POWER_PEERS	LINK_PEERS
+
+/* Margin (signal score 0-255) window. Above POWER_HIGH power is lowered,
+ * below POWER_LOW - raised. */
+#define POWER_HIGH	230
+#define POWER_LOW	150
+
+/* Target PER; power is raised when Link PER exceeds it (0xFFFF = 100%) */
+#define POWER_PER	(0xFFFF / 20)	/* 5% */
+
+/* Good feedbacks in a row required before power is lowered again */
+#define POWER_HOLD	4
+
+/** TX power control */
+namespace Power {
+	/** Per peer power state */
+	typedef struct {
+		uint8_t Power;		/**< RF12_TXPWR_* step; 0 = max */
+		uint8_t Good;		/**< Feedbacks over POWER_HIGH in a row */
+	} peer_t;
+
+	/** Power control state */
+	static struct {
+		peer_t Peer[POWER_PEERS];
+	} State;
+
+	/** Margin byte for feedback; signal score of received packet */
+	static inline uint8_t Margin(const Comm::quality_t *Q, Comm::len_t Length)
+	{
+		return Link::Score(Q, Length);
+	}
+
+	/** Set RFM TX power for given peer. Call between frames. */
+	static inline void Use(uint8_t Peer)
+	{
+		if (RF::TXPower != State.Peer[Peer].Power)
+			RF::SetPower(State.Peer[Peer].Power);
+	}
+
+	/** Handle margin reported by peer; returns new power step */
+	static uint8_t Feedback(uint8_t Peer, uint8_t Margin)
+	{
+		peer_t *P = &State.Peer[Peer];
+
+		if (Margin < POWER_LOW || Link::Get(Peer)->PER > POWER_PER) {
+			/* Too weak - raise power at once */
+			P->Good = 0;
+			if (P->Power > RF12_TXPWR_0)
+				P->Power--;
+		} else if (Margin > POWER_HIGH) {
+			/* Strong - lower slowly */
+			if (++P->Good >= POWER_HOLD) {
+				P->Good = 0;
+				if (P->Power < RF12_TXPWR_n21)
+					P->Power++;
+			}
+		} else {
+			P->Good = 0;
+		}
+		return P->Power;
+	}
+
+	/** Missing feedback (lost ack) - go back to full power */
+	static inline void Lost(uint8_t Peer)
+	{
+		State.Peer[Peer].Power = RF12_TXPWR_0;
+		State.Peer[Peer].Good = 0;
+	}
+}
@@ -11,6 +11,9 @@
 
 #include <inttypes.h>
 #include <util/crc16.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
 
 /* Changes sets of pin configuration and SPI speed.
  * + Some trivial things in Comm testcases.
@@ -21,18 +24,43 @@
 #define RF_MASTER	1
 #define RF_DEBUG	1
 
+/* Startup: RFM status is polled every RF_BOOT_POLL us until it leaves
+ * power-on reset, but no longer than RF_BOOT_MAX us. */
+#define RF_BOOT_POLL	100
+#define RF_BOOT_MAX	60000
+
+/***
+ * Instance configuration
+ *
+ * This file (and Comm.cc) might be included again to drive another
+ * RFM12 sharing the SPI bus. Before including it define a different
+ * namespace RF_NS, chip select pin RF_SS (on RF_PORT) and the whole
+ * RF_IRQ_* set (PIN, PORT, DDR, MASK, vect, CONFIG(), ON(), OFF()).
+ * Comm.cc undefines them at its end. Keep chip selects of all
+ * modules high before the first RF::Init(). Each SPI transfer runs
+ * with interrupts off, so interrupts of the other instances can't
+ * cut into it; ISRs talk to the bus directly.
+ ***/
+#ifndef RF_NS
+#	define RF_NS	RF
+#endif
+
 /***
  * AVR port configuration
  ***/
 #define RF_PORT		PORTB
 #define RF_PIN		PINB
 #define RF_DDR		DDRB
-#define RF_SS		PB4
+#ifndef RF_SS
+#	define RF_SS	PB4
+#endif
 #define RF_SCK		PB7
 #define RF_MOSI		PB5
 #define RF_MISO		PB6
 
-#if RF_MASTER == 1
+#if defined(RF_IRQ_vect)
+	/* Set by the includer for another instance */
+#elif RF_MASTER == 1
 #	define RF_IRQ_PIN	PINB
 #	define RF_IRQ_PORT	PORTB
 #	define RF_IRQ_DDR	DDRB
@@ -100,6 +128,9 @@
 //#define RF12_FQ		RF12_FQ_CMD(0x0640) /* 10 * 1 * (43 + 0x0640/4000) = 434Mhz */
 #define RF12_FQ		RF12_FQ_CMD(0x0190) /* 10 * 1 * (43 + 0x0190/4000) = 431Mhz */
 
+/* Time required by PLL to settle after the frequency change [us] */
+#define RF12_PLL_SETTLE	250
+
 /* Select data rate */
 //#define RF12_DR		RF12_DR_CMD(0x0047) /* 4.8kbps */
 //#define RF12_DR		RF12_DR_CMD(0x0021) /* 10kbps */
@@ -119,22 +150,76 @@
 #define RF12_AFC	RF12_AFC_CMD(ATRECV, NORESTR, RF12_OE | RF12_EN) /* Also try ATRECV/ATPWR/INDEP */
 
 #define RF12_TXCTL	RF12_TXCTL_CMD(0x05, 0) /* 90kHz */
+
+/* Data rate presets which might be selected at runtime (RF::SetRate);
+ * each with matching receiver bandwidth and TX deviation.
+ * Default one must match RF12_DR/RF12_RXCTL/RF12_TXCTL above. */
+#define RF12_RATES							\
+	{RF12_DR_CMD(0x0047), RF12_BW_67, 0x02},	/* 4.8kbps; 45kHz */	\
+	{RF12_DR_CMD(0x0021), RF12_BW_67, 0x02},	/* 10kbps; 45kHz */	\
+	{RF12_DR_CMD(0x0010), RF12_BW_134, 0x05},	/* 20kbps; 90kHz */	\
+	{RF12_DR_CMD(0x0005), RF12_BW_200, 0x07},	/* 50kbps; 120kHz */	\
+	{RF12_DR_CMD(0x0003), RF12_BW_270, 0x08}	/* 85kbps; 135kHz */
+#define RF12_RATE_DEF	2	/* 20kbps */
 #define RF12_WAKE	RF12_WAKE_CMD(0, 0)	/* Don't use */
 #define RF12_DUTY	RF12_DUTY_CMD(0, 0)	/* Don't use */
 //#define RF12_BATT	RF12_BATT_CMD(1_66, 0) /* from Datasheet */
 #define RF12_BATT	RF12_BATT_CMD(10, 0) /* From library */
 
 /** RFM12 configuration/control subsystem */
-namespace RF {
+namespace RF_NS {
 	/** RF modes */
 	enum RF_Mode {TX, RX, DEF, ECO} CurMode;
 
 	/** Temporary value; used for clearing SPIF flag */
 	static uint16_t SC_tmp;
 
-	/** Send a command to RFM, return reply */
+	/** Data rate preset: data rate with matching RX/TX settings */
+	typedef struct {
+		uint16_t DR;		/**< Data rate command */
+		uint8_t BW;		/**< Receiver bandwidth (RF12_BW_*) */
+		uint8_t Dev;		/**< TX deviation; M parameter of TXCTL */
+	} rate_t;
+
+	/** Available data rates, from the slowest one */
+	static const rate_t Rates[] PROGMEM = { RF12_RATES };
+	const uint8_t RateCount = sizeof(Rates) / sizeof(*Rates);
+
+	/** Currently selected rate preset */
+	static uint8_t CurRate = RF12_RATE_DEF;
+	/** TX power bits of TX control register (RF12_TXPWR_*) */
+	static uint8_t TXPower = RF12_TXPWR_0;
+	/** Current frequency parameter (F of RF12_FQ_CMD) */
+	static uint16_t CurFreq = RF12_FQ & 0x0FFF;
+	/** Crystal error correction added to every frequency set */
+	static int8_t FreqCorr = 0;
+	/** Frequency command last written */
+	static uint16_t FreqCmd = RF12_FQ;
+
+	/** Startup report */
+	static struct {
+		uint16_t Time;	/**< Time until RFM was ready [us] */
+		uint8_t Warm;	/**< RFM kept power and configuration */
+	} Boot;
+
+	/** Signature of configuration written into RFM; survives MCU reset.
+	 * Cleared when settings are changed at runtime. */
+	static uint16_t ConfigSign __attribute__((section(".noinit")));
+
+	/** Receiver settings; RX control is kept without bandwidth bits
+	 * which are set by the rate */
+	static uint16_t RXCtl = RF12_RXCTL & ~RF12_BW_MASK;
+	static uint16_t Filter = RF12_FILTER;
+	static uint16_t AFC = RF12_AFC;
+
+	/** Send a command to RFM, return reply. Interrupts are off during
+	 * the transfer - an interrupt of another instance on the same SPI
+	 * bus would select its chip in the middle of it. */
 	static inline uint16_t SendCommand(const uint16_t Cmd)
 	{
+		const uint8_t SReg = SREG;
+		uint16_t Reply;
+		cli();
 		RF_SS_LOW();
 
 		SPDR = Cmd>>8;
@@ -146,13 +231,18 @@ namespace RF {
 		SC_tmp |= SPDR;
 
 		RF_SS_HIGH();
+		Reply = SC_tmp;
+		SREG = SReg;
 
-		return SC_tmp;
+		return Reply;
 	}
 
-	/** Send a command, ignore reply */
+	/** Send a command, ignore reply; interrupts are off as in
+	 * SendCommand() */
 	static inline void VSendCommand(const uint16_t Cmd)
 	{
+		const uint8_t SReg = SREG;
+		cli();
 		RF_SS_LOW();
 
 		SPDR = Cmd>>8;
@@ -165,6 +255,7 @@ namespace RF {
 		SC_tmp |= SPDR;
 
 		RF_SS_HIGH();
+		SREG = SReg;
 	}
 
 	/** Set RFM working mode (TX, RX, DEF, ECO) */
@@ -215,6 +306,7 @@ namespace RF {
 	static inline void Init(void)
 	{
 		uint8_t tmp;
+		uint16_t Sign;
 		const uint16_t Config[] = {
 			RF12_CONFIG,
 			RF12_PM_DEF,
@@ -253,13 +345,105 @@ namespace RF {
 		tmp = SPSR; /* Clear SPIF */
 		tmp = SPDR;
 
+		/* Instead of waiting a fixed time poll until RFM leaves
+		 * power-on reset. It keeps IRQ low until POR is read out.
+		 * If we haven't seen POR the RFM kept its configuration. */
+		Boot.Time = 0;
+		Boot.Warm = 1;
+		for (;;) {
+			if (RF12_S_POR(SendCommand(0x0000)))
+				Boot.Warm = 0;
+			if ((RF_IRQ_PIN & RF_IRQ_MASK) || Boot.Time >= RF_BOOT_MAX)
+				break;
+			_delay_us(RF_BOOT_POLL);
+			Boot.Time += RF_BOOT_POLL;
+		}
+
+		Sign = 0xFFFF;
 		for (tmp = 0; tmp < sizeof(Config)/sizeof(*Config); tmp++) {
-/*			printf("RF: Cmd=0x%04X, num=%d\n", Config[tmp], tmp); */
-			VSendCommand(Config[tmp]);
+			Sign = _crc_ccitt_update(Sign, Config[tmp] & 0xFF);
+			Sign = _crc_ccitt_update(Sign, Config[tmp] >> 8);
+		}
+
+		if (Boot.Warm && ConfigSign == Sign) {
+			/* Warm reset; only return to default mode */
+			VSendCommand(RF12_PM_DEF);
+			VSendCommand(RF12_FIFO_OFF);
+		} else {
+			Boot.Warm = 0;
+			for (tmp = 0; tmp < sizeof(Config)/sizeof(*Config); tmp++) {
+/*				printf("RF: Cmd=0x%04X, num=%d\n", Config[tmp], tmp); */
+				VSendCommand(Config[tmp]);
+			}
+			ConfigSign = Sign;
 		}
 		VSendCommand(0x00); /* Read status */
 	}
 
+	/** Switch data rate, receiver bandwidth and TX deviation
+	 * at once. Must be called between frames. */
+	static void SetRate(uint8_t Rate)
+	{
+		if (Rate >= RateCount)
+			Rate = RateCount - 1;
+		CurRate = Rate;
+		ConfigSign = 0;
+		VSendCommand(pgm_read_word(&Rates[Rate].DR));
+		VSendCommand(RXCtl | pgm_read_byte(&Rates[Rate].BW));
+		VSendCommand(RF12_TXCTL_BASE | TXPower |
+			     ((uint16_t)pgm_read_byte(&Rates[Rate].Dev) << 4));
+	}
+
+	/** Time of one byte at current rate [us]; bit rate is
+	 * 10MHz / 29 / (R + 1) / (1 + CS * 7) */
+	static inline uint16_t ByteTime(void)
+	{
+		const uint16_t DR = pgm_read_word(&Rates[CurRate].DR);
+		uint16_t T = (uint16_t)(8 * 29) * ((DR & 0x7F) + 1) / 10;
+		if (DR & 0x80)
+			T *= 8;
+		return T;
+	}
+
+	/** Set receiver settings: RX control (VDI response, LNA, RSSI
+	 * without bandwidth), clock recovery filter and AFC commands.
+	 * Must be called between frames. */
+	static void SetRX(uint16_t RXCtlCmd, uint16_t FilterCmd, uint16_t AFCCmd)
+	{
+		ConfigSign = 0;
+		RXCtl = RXCtlCmd & ~RF12_BW_MASK;
+		Filter = FilterCmd;
+		AFC = AFCCmd;
+		VSendCommand(RXCtl | pgm_read_byte(&Rates[CurRate].BW));
+		VSendCommand(Filter);
+		VSendCommand(AFC);
+	}
+
+	/** Retune to frequency parameter F (96-3903) with one command
+	 * and wait for the PLL to settle (if it really changed).
+	 * Must be called between frames. */
+	static inline void SetFreq(uint16_t F)
+	{
+		const uint16_t Cmd = RF12_FQ_CMD((uint16_t)(F + FreqCorr));
+		CurFreq = F;
+		if (Cmd == FreqCmd)
+			return;
+		FreqCmd = Cmd;
+		ConfigSign = 0;
+		VSendCommand(Cmd);
+		_delay_us(RF12_PLL_SETTLE);
+	}
+
+	/** Set TX power (RF12_TXPWR_*); rewrites only TX control register.
+	 * Must be called between frames. */
+	static inline void SetPower(uint8_t Power)
+	{
+		TXPower = Power & 0x07;
+		ConfigSign = 0;
+		VSendCommand(RF12_TXCTL_BASE | TXPower |
+			     ((uint16_t)pgm_read_byte(&Rates[CurRate].Dev) << 4));
+	}
+
 #if RF_DEBUG
 #if RF_MASTER
 	/** Debug function - reads status and prints it on LCD */
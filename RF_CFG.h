@@ -85,6 +85,7 @@
 #define RF12_BW_200	RF12_I2
 #define RF12_BW_134	(RF12_I2 | RF12_I0)
 #define RF12_BW_67	(RF12_I2 | RF12_I1)
+#define RF12_BW_MASK	(RF12_I2 | RF12_I1 | RF12_I0)
 
 #define RF12_G1		(1<<4)	/* LNA gain select relative to maximum [dB] (all negative) */
 #define RF12_G0		(1<<3)
@@ -0,0 +1,118 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Automatic data rate selection per link.
+ *
+ * Requires RF.cc and Comm.cc modules included. Keeps success statistics
+ * for each peer, probes higher data rates on good links and falls back
+ * when frames are lost (CRC error, ack timeout).
+ *
+ * Comm doesn't know about addresses, so peer is a number chosen by
+ * application. Both ends of a link must see the same successes and
+ * failures to stay on the same rate, so this should be used with
+ * request/ack exchanges: a lost request or lost ack is a failure on
+ * both sides. After RATE_LOST failures in a row link falls back to the
+ * slowest rate, where both ends meet again.
+ *
+ * Example:
+ * Rate::Use(Peer);			// Before exchange, Comm idle
+ * ... send request, wait for ack ...
+ * Rate::Report(Peer, AckReceived);
+ ********************/
+
+/***
+ * Rate adaptation configuration
+ ***/
+
+/* Number of peers tracked */
+#define RATE_PEERS	8
+
+/* Successes in a row required before a higher rate is probed.
+ * Doubled with each failed probe (up to RATE_BACKOFF times) */
+#define RATE_UP		10
+#define RATE_BACKOFF	4
+
+/* Failures in a row before falling back one rate */
+#define RATE_DOWN	2
+
+/* Failures in a row before falling back to the slowest rate */
+#define RATE_LOST	6
+
+/** Data rate adaptation */
+namespace Rate {
+	/** Per peer link state */
+	typedef struct {
+		uint8_t Rate;		/**< Current rate preset */
+		uint8_t Good;		/**< Successes in a row */
+		uint8_t Bad;		/**< Failures in a row */
+		uint8_t Probe : 1;	/**< Rate was just raised */
+		uint8_t Backoff : 3;	/**< Failed probes in a row */
+		uint16_t Ok;		/**< Total successes */
+		uint16_t Fail;		/**< Total failures */
+	} peer_t;
+
+	/** Rate adaptation state */
+	static struct {
+		peer_t Peer[RATE_PEERS];
+	} State;
+
+	/** Start all peers at the default rate */
+	static inline void Init(void)
+	{
+		uint8_t i;
+		memset(&State, 0, sizeof(State));
+		for (i = 0; i < RATE_PEERS; i++)
+			State.Peer[i].Rate = RF12_RATE_DEF;
+	}
+
+	/** Switch RFM to the rate of given peer. Call between frames. */
+	static inline void Use(uint8_t Peer)
+	{
+		if (RF::CurRate != State.Peer[Peer].Rate)
+			RF::SetRate(State.Peer[Peer].Rate);
+	}
+
+	/** Report result of an exchange with a peer; returns new rate */
+	static uint8_t Report(uint8_t Peer, char Ok)
+	{
+		peer_t *P = &State.Peer[Peer];
+
+		if (Ok) {
+			P->Ok++;
+			P->Bad = 0;
+			if (P->Probe) {
+				/* Probe succeeded; stay here */
+				P->Probe = 0;
+				P->Backoff = 0;
+			}
+			if (++P->Good >= (RATE_UP << P->Backoff) &&
+			    P->Rate < RF::RateCount - 1) {
+				P->Rate++;
+				P->Probe = 1;
+				P->Good = 0;
+			}
+			return P->Rate;
+		}
+
+		P->Fail++;
+		P->Good = 0;
+		P->Bad++;
+		if (P->Probe) {
+			/* Higher rate doesn't work; go back and wait longer */
+			P->Probe = 0;
+			P->Rate--;
+			P->Bad = 0;
+			if (P->Backoff < RATE_BACKOFF)
+				P->Backoff++;
+		} else if (P->Bad >= RATE_LOST) {
+			/* Link lost; meet at the slowest rate */
+			P->Rate = 0;
+			P->Bad = 0;
+		} else if (P->Bad >= RATE_DOWN && P->Rate > 0 &&
+			   P->Bad % RATE_DOWN == 0) {
+			P->Rate--;
+		}
+		return P->Rate;
+	}
+}
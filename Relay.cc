@@ -0,0 +1,316 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Multi-hop relaying with routing table and duplicate suppression.
+ *
+ * Requires Comm.cc module included (RX without RXPOOL, TX with TXSG).
+ * Each frame body starts with a relay header:
+ * DST SRC NEXT PREV SEQ TTL DATA
+ * NEXT is the node which should pass the frame further (or broadcast),
+ * PREV the node which transmitted it. Routes are learned backwards from
+ * every heard frame (SRC is reachable through PREV) and might be set by
+ * hand. Unknown destinations are flooded. SRC/SEQ pairs of recent frames
+ * are remembered, so retransmissions and flooded copies are dropped.
+ *
+ * Store-and-forward: frame is sent again straight from the RX buffer
+ * with TXSend() - only the header is rewritten, nothing is copied.
+ *
+ * Cut-through (RELAY_OUT): RFM12 is half-duplex - once it turns to TX
+ * the rest of the incoming frame is lost - so retransmission can't start
+ * before the end of frame on one module. With a second RFM12 instance
+ * (see Comm.cc) working on another channel, Poll() starts forwarding on
+ * it as soon as the relay header is received; the body is streamed from
+ * the RX buffer while it's still being filled. Transmitter is always
+ * behind, as it has to send synchronization and header first. If the
+ * incoming frame fails the outgoing one is aborted and next hop drops
+ * it. Latency of a hop becomes the header time instead of frame time.
+ * Poll() must be called at least once per byte time then.
+ *
+ * Example:
+ * Relay::Init(MyId);
+ * Relay::Send(Dst, Data, Length);
+ * ... Comm::RXInit(); Comm::RXWait(); ...
+ * Buff = Comm::RXGetPacket(&Length);
+ * if ((Data = Relay::Handle(Buff, &Length)) != NULL)
+ *	Consume(Data, Length);
+ ********************/
+
+/***
+ * Relay configuration
+ ***/
+
+/* Routing table entries */
+#define RELAY_ROUTES	16
+
+/* Remembered SRC/SEQ pairs (power of 2) */
+#define RELAY_SEEN	16
+
+/* Initial hop limit */
+#define RELAY_TTL	6
+
+/* Broadcast address */
+#define RELAY_BCAST	0xFF
+
+/* Config nibble marking relayed frames (if control byte is compiled) */
+#define RELAY_CONFIG	0x0D
+
+/* Second Comm instance used for cut-through forwarding; leave
+ * undefined for store-and-forward on a single module */
+/* #define RELAY_OUT	Comm2 */
+
+/** Multi-hop relaying */
+namespace Relay {
+	/** Relay header; beginning of each frame body */
+	typedef struct {
+		uint8_t Dst, Src;
+		uint8_t Next, Prev;
+		uint8_t Seq;
+		uint8_t TTL;
+	} head_t;
+
+	/** Route to a destination; Hops 0 - unused */
+	typedef struct {
+		uint8_t Dst, Next, Hops;
+	} route_t;
+
+#ifdef RELAY_OUT
+	namespace Out = ::RELAY_OUT;
+#else
+	namespace Out = ::Comm;
+#endif
+
+	/** Relay state */
+	static struct {
+		uint8_t Id;
+		uint8_t Seq;
+		route_t Route[RELAY_ROUTES];
+		struct {
+			uint8_t Src, Seq;
+		} Seen[RELAY_SEEN];
+		uint8_t SeenHead;
+
+		/* Outgoing frame */
+		head_t Head;
+		Out::segment_t Seg[2];
+#ifdef RELAY_OUT
+		uint16_t Cut;		/* Bytes received when last polled;
+					   0 - no cut-through in progress */
+		uint16_t CutCount;	/* Frames forwarded with cut-through */
+		uint16_t CutAbort;	/* Of them aborted */
+#endif /* OUT */
+	} State;
+
+	/** Start with empty tables */
+	static inline void Init(uint8_t Id)
+	{
+		memset(&State, 0, sizeof(State));
+		State.Id = Id;
+		/* Src 0xFF never appears */
+		memset(State.Seen, RELAY_BCAST, sizeof(State.Seen));
+	}
+
+	/** Next hop to destination; RELAY_BCAST if unknown */
+	static inline uint8_t Lookup(uint8_t Dst)
+	{
+		uint8_t i;
+		for (i = 0; i < RELAY_ROUTES; i++)
+			if (State.Route[i].Hops && State.Route[i].Dst == Dst)
+				return State.Route[i].Next;
+		return RELAY_BCAST;
+	}
+
+	/** Set route; replaces longer or the same one. Returns 0 if the
+	 * table is full and the route wasn't stored. */
+	static char SetRoute(uint8_t Dst, uint8_t Next, uint8_t Hops)
+	{
+		route_t *Free = NULL, *R;
+		uint8_t i;
+		for (i = 0; i < RELAY_ROUTES; i++) {
+			R = &State.Route[i];
+			if (!R->Hops) {
+				if (!Free)
+					Free = R;
+				continue;
+			}
+			if (R->Dst != Dst)
+				continue;
+			if (Hops <= R->Hops || Next == R->Next) {
+				R->Next = Next;
+				R->Hops = Hops;
+			}
+			return 1;
+		}
+		if (!Free)
+			return 0;
+		Free->Dst = Dst;
+		Free->Next = Next;
+		Free->Hops = Hops;
+		return 1;
+	}
+
+	/** Drop route (For e.g. when the next hop is lost) */
+	static inline void Forget(uint8_t Dst)
+	{
+		uint8_t i;
+		for (i = 0; i < RELAY_ROUTES; i++)
+			if (State.Route[i].Dst == Dst)
+				State.Route[i].Hops = 0;
+	}
+
+	/** Check and remember SRC/SEQ pair; returns 1 for a duplicate */
+	static char Seen(uint8_t Src, uint8_t Seq)
+	{
+		uint8_t i;
+		for (i = 0; i < RELAY_SEEN; i++)
+			if (State.Seen[i].Src == Src && State.Seen[i].Seq == Seq)
+				return 1;
+		i = State.SeenHead++ & (RELAY_SEEN - 1);
+		State.Seen[i].Src = Src;
+		State.Seen[i].Seq = Seq;
+		return 0;
+	}
+
+	/** Learn route back to the sender of heard frame */
+	static inline void Learn(const head_t *H)
+	{
+		if (H->Src != State.Id && H->TTL <= RELAY_TTL)
+			SetRoute(H->Src, H->Prev, RELAY_TTL - H->TTL + 1);
+	}
+
+	/** Should this node pass the frame further */
+	static inline char ToForward(const head_t *H)
+	{
+		return H->Dst != State.Id && H->TTL > 1 &&
+			(H->Next == State.Id || H->Next == RELAY_BCAST);
+	}
+
+	/** Transmit header + body. Blocks until previous frame is sent. */
+	static void Transmit(const void *Body, Comm::len_t Length)
+	{
+		Out::TXWait();
+		State.Seg[0].Data = &State.Head;
+		State.Seg[0].Length = sizeof(head_t);
+		State.Seg[0].Flags = Out::SG_RAM;
+		State.Seg[1].Data = Body;
+		State.Seg[1].Length = Length;
+		State.Seg[1].Flags = Out::SG_RAM;
+#if COMM1_CTR
+		Out::TXSendConfig(State.Seg, 2, RELAY_CONFIG);
+#else
+		Out::TXSend(State.Seg, 2);
+#endif
+	}
+
+	/** Build forwarded header from received one */
+	static inline void Rewrite(const head_t *H)
+	{
+		State.Head = *H;
+		State.Head.Next = H->Dst == RELAY_BCAST ? RELAY_BCAST : Lookup(H->Dst);
+		State.Head.Prev = State.Id;
+		State.Head.TTL = H->TTL - 1;
+	}
+
+	/** Send data to a node (or RELAY_BCAST). Data must be left
+	 * untouched until Comm::TXWait(). */
+	static inline void Send(uint8_t Dst, const void *Data, Comm::len_t Length)
+	{
+		State.Head.Dst = Dst;
+		State.Head.Src = State.Id;
+		State.Head.Next = Dst == RELAY_BCAST ? RELAY_BCAST : Lookup(Dst);
+		State.Head.Prev = State.Id;
+		State.Head.Seq = State.Seq++;
+		State.Head.TTL = RELAY_TTL;
+		/* Don't pass own frame if it comes back */
+		Seen(State.Id, State.Head.Seq);
+		Transmit(Data, Length);
+	}
+
+	/**
+	 * \brief
+	 *   Handle a received frame: learn route, drop duplicates,
+	 *   forward it (store-and-forward; blocks until sent) and
+	 *   return the data if it's addressed to us.
+	 *
+	 * \param Length
+	 *   Frame length; replaced with data length.
+	 *
+	 * \return Data or NULL if the frame isn't for this node.
+	 */
+	static const char *Handle(const char *Buff, Comm::len_t *Length)
+	{
+		const head_t *H = (const head_t *)Buff;
+		Comm::len_t DataLen;
+
+		if (*Length < sizeof(head_t))
+			return NULL;
+		DataLen = *Length - sizeof(head_t);
+#if COMM1_CTR
+		if (Comm::RXGetConfig() != RELAY_CONFIG)
+			return NULL;
+#endif
+		Learn(H);
+		if (Seen(H->Src, H->Seq))
+			return NULL;
+
+		if (ToForward(H)) {
+			Rewrite(H);
+			Transmit(Buff + sizeof(head_t), DataLen);
+			Out::TXWait();
+		}
+
+		if (H->Dst != State.Id && H->Dst != RELAY_BCAST)
+			return NULL;
+		*Length = DataLen;
+		return Buff + sizeof(head_t);
+	}
+
+#ifdef RELAY_OUT
+	/** Cut-through forwarding; call in a tight loop while receiving.
+	 * Returns 1 while a frame is being forwarded - Comm must not
+	 * be restarted then. Only unicast frames are cut through;
+	 * Handle() later drops them as duplicates. */
+	static char Poll(void)
+	{
+		const head_t *H = (const head_t *)Comm::RXGetBuff();
+		Comm::len_t Length;
+		uint16_t Count = Comm::RXGetCount(&Length);
+
+		if (State.Cut) {
+			if (Comm::State.Mode == Comm::MX) {
+				/* Frame received correctly; wait for the end */
+				if (Out::State.Mode == Out::MT)
+					return 1;
+			} else if (Count == 0 || Count < State.Cut) {
+				/* Failed (and maybe rewound) - cut the copy */
+				Out::TXAbort();
+				State.CutAbort++;
+			} else {
+				State.Cut = Count;
+				return 1;
+			}
+			State.Cut = 0;
+			return 0;
+		}
+
+		if (Count < Comm::HeadSize + sizeof(head_t) || !Length ||
+		    Length < sizeof(head_t))
+			return 0;
+#if COMM1_CTR
+		if (Comm::RXGetConfig() != RELAY_CONFIG)
+			return 0;
+#endif
+		/* Broadcasts are delivered here too; leave them to Handle() */
+		if (H->Next != State.Id || H->Dst == RELAY_BCAST || !ToForward(H))
+			return 0;
+		if (Seen(H->Src, H->Seq))
+			return 0;
+		Learn(H);
+		Rewrite(H);
+		Transmit((const char *)H + sizeof(head_t), Length - sizeof(head_t));
+		State.Cut = Count;
+		State.CutCount++;
+		return 1;
+	}
+#endif /* OUT */
+}
@@ -0,0 +1,116 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Spectrum scanner building RSSI occupancy map.
+ *
+ * Requires RF.cc module included; Comm must be idle (interrupt off).
+ * Steps frequency across a range at chosen receiver bandwidth and at
+ * each step measures signal level a number of times. RFM12 gives only
+ * a single RSSI bit (signal over threshold), so the level is found by
+ * changing the RSSI threshold (n103 ... n61). Binary search is used
+ * instead of a full sweep - 3 threshold changes per sample instead of 8.
+ *
+ * Result for each channel is a histogram: Hist[L] - number of samples
+ * with level L, where L is the count of thresholds exceeded
+ * (0 - below -103dBm, 8 - over -61dBm).
+ *
+ * Example:
+ * Scan::hist_t Map[12];
+ * Scan::Run(0x0190, 0x00A0, 12, RF12_BW_134, 16, Map);
+ * Best = Scan::Best(Map, 12);
+ ********************/
+
+/***
+ * Scanner configuration
+ ***/
+
+/* Time required by RSSI detector to follow threshold change [us] */
+#define SCAN_RSSI_SETTLE	500
+
+/* Number of RSSI thresholds */
+#define SCAN_LEVELS	8
+
+/** Spectrum scanner */
+namespace Scan {
+	/** Occupancy histogram of one channel */
+	typedef struct {
+		uint8_t Hist[SCAN_LEVELS + 1];
+	} hist_t;
+
+	/** Measure signal level (0 - SCAN_LEVELS) at current frequency */
+	static inline uint8_t Level(uint16_t RXCtl)
+	{
+		uint8_t Low = 0, High = SCAN_LEVELS, Mid;
+		/* Find the number of thresholds exceeded; threshold
+		 * with index Mid is exceeded when level > Mid */
+		while (Low < High) {
+			Mid = (Low + High) / 2;
+			RF::VSendCommand(RXCtl | Mid);
+			_delay_us(SCAN_RSSI_SETTLE);
+			if (RF12_S_RSSI(RF::SendCommand(0x0000)))
+				Low = Mid + 1;
+			else
+				High = Mid;
+		}
+		return Low;
+	}
+
+	/**
+	 * \brief
+	 *   Scan Count channels starting at frequency parameter From
+	 *   spaced by Step and fill histogram for each of them.
+	 *   Restores frequency and receiver settings afterwards.
+	 *
+	 * \param BW
+	 *   Receiver bandwidth (RF12_BW_*)
+	 * \param Samples
+	 *   Number of samples per channel (max 255)
+	 */
+	static void Run(uint16_t From, uint16_t Step, uint8_t Count,
+			uint16_t BW, uint8_t Samples, hist_t *Out)
+	{
+		const uint16_t RXCtl = RF12_RXCTL_BASE | RF12_VDI | RF12_VDI_FAST |
+			RF12_LNA_0 | BW;
+		const uint16_t Freq = RF::CurFreq;
+		uint8_t Ch, i;
+
+		RF::Mode(RF::RX);
+		for (Ch = 0; Ch < Count; Ch++) {
+			memset(&Out[Ch], 0, sizeof(*Out));
+			RF::SetFreq(From + Ch * Step);
+			for (i = 0; i < Samples; i++)
+				Out[Ch].Hist[Level(RXCtl)]++;
+		}
+
+		/* Restore settings */
+		RF::SetRate(RF::CurRate);
+		RF::SetFreq(Freq);
+		RF::Mode(RF::DEF);
+	}
+
+	/** Occupancy score of channel; weighted by level, lower is better */
+	static inline uint16_t Score(const hist_t *H)
+	{
+		uint16_t Score = 0;
+		uint8_t L;
+		for (L = 1; L <= SCAN_LEVELS; L++)
+			Score += (uint16_t)H->Hist[L] * L;
+		return Score;
+	}
+
+	/** Return index of the least occupied channel */
+	static uint8_t Best(const hist_t *Map, uint8_t Count)
+	{
+		uint8_t Ch, Best = 0;
+		uint16_t S, BestScore = 0xFFFF;
+		for (Ch = 0; Ch < Count; Ch++) {
+			S = Score(&Map[Ch]);
+			if (S < BestScore) {
+				BestScore = S;
+				Best = Ch;
+			}
+		}
+		return Best;
+	}
+}
@@ -0,0 +1,81 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Promiscuous sniffer; streams the capture ring over UART.
+ *
+ * Requires Comm.cc module included with COMM_SNIFF (and COMM_RXRETRY,
+ * so the receiver isn't stopped by a broken frame; with COMM_RXPOOL at
+ * least one buffer must be given first). Comm captures every
+ * attempted frame in its interrupt; Poll() called from the main loop
+ * only restarts the receiver after a correct frame and copies committed
+ * records to the UART whenever its data register is empty - no UART
+ * interrupt is used and the capture interrupt is never delayed.
+ * Records are sent as captured (see COMM_SNIFF in Comm.cc), including
+ * reports of frames dropped when the ring was full. Convert the stream
+ * with Host/sniff2pcap.py.
+ *
+ * UART must be configured by the application (baud rate, TX on);
+ * it should be fast enough to carry the channel traffic plus 8 bytes
+ * per frame, or frames are dropped.
+ *
+ * Example:
+ * Comm::Init(); UART init; sei();
+ * Sniff::Init();
+ * for (;;) Sniff::Poll();
+ ********************/
+
+/***
+ * Sniffer configuration
+ ***/
+
+/* Bytes taken from the capture ring at once */
+#define SNIFF_CHUNK	16
+
+/* UART hardware */
+#define SNIFF_UDR	UDR0
+#define SNIFF_UCSRA	UCSR0A
+#define SNIFF_UDRE	UDRE0
+
+/** Promiscuous sniffer */
+namespace Sniff {
+	/** Sniffer state */
+	static struct {
+		uint8_t Buff[SNIFF_CHUNK];
+		uint8_t Pos, Used;	/* Next byte to send; bytes in Buff */
+	} State;
+
+	/** Start listening */
+	static inline void Init(void)
+	{
+		memset(&State, 0, sizeof(State));
+		Comm::RXInit();
+	}
+
+	/** Sniffer work; call from the main loop as often as possible */
+	static void Poll(void)
+	{
+#if COMM1_RXPOOL
+		{
+			/* Contents are in the capture already; recycle buffers */
+			Comm::packet_t *Pkt;
+			Comm::len_t Length;
+			while ((Pkt = Comm::RXTake(&Length)) != NULL)
+				Comm::RXGive(Pkt);
+		}
+#endif /* RXPOOL */
+		/* Frame received correctly (or receiver stopped); listen again */
+		if (Comm::State.Mode == Comm::MX || Comm::State.Mode == Comm::MI)
+			Comm::RXInit();
+
+		while (SNIFF_UCSRA & (1<<SNIFF_UDRE)) {
+			if (State.Pos == State.Used) {
+				State.Pos = 0;
+				State.Used = Comm::SniffRead(State.Buff, SNIFF_CHUNK);
+				if (!State.Used)
+					return;
+			}
+			SNIFF_UDR = State.Buff[State.Pos++];
+		}
+	}
+}
@@ -0,0 +1,299 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Flooding time synchronization.
+ *
+ * Requires Comm.cc module included with COMM_STAMP (and COMM_TXSG for
+ * sending). Local clock is COMM_TICK extended to 32 bits by counting
+ * its overflows - Overflow() must be called from the timer overflow
+ * interrupt. Comm stamps are 16 bit, so a received frame must be handed
+ * to Received() before the timer wraps.
+ *
+ * The node with the lowest Id is the root; its local clock is the
+ * global time. Root starts a round with each Send(), every synchronized
+ * node sends once per round too, so the time floods through the network.
+ * A frame carries the global time of the end of the previous frame of
+ * the same sender (two-step, like PTP follow-up), as the exact end of
+ * transmission is known only afterwards. Receiver pairs it with the
+ * stamp of that previous frame, and keeps a table of (local, global)
+ * pairs. Offset and skew are estimated by linear regression over them.
+ * If no root is heard for TSYNC_ROOT_TIMEOUT rounds node becomes a root.
+ *
+ * Stamps are taken at the first byte of received frame and at the
+ * end of sent one, so the delay between them is constant for the
+ * fixed frame length. It's TSYNC_BYTE * frame bytes + TSYNC_FIX.
+ *
+ * Example:
+ * ISR(TIMER1_OVF_vect) { TimeSync::Overflow(); }
+ * TimeSync::Init(MyId);
+ * TimeSync::Send();			// Once per round period, Comm idle
+ * if (Comm::RXGetConfig() == TSYNC_CONFIG)	// On frame received
+ *	TimeSync::Received(Buff, Length, Comm::RXGetStamp());
+ * Global = TimeSync::Now();
+ ********************/
+
+/***
+ * Time sync configuration
+ ***/
+
+/* Regression table size */
+#define TSYNC_POINTS	8
+
+/* Points required before node is synchronized and floods time further */
+#define TSYNC_MIN	3
+
+/* Neighbours remembered for pairing two-step frames */
+#define TSYNC_NEIGH	4
+
+/* Rounds without root frame after which node claims root */
+#define TSYNC_ROOT_TIMEOUT	5
+
+/* COMM_TICK ticks per byte at used rate (For e.g. 1us ticks at 20kbps)
+ * and constant delay (interrupt latency) between TX and RX stamps */
+#define TSYNC_BYTE	400
+#define TSYNC_FIX	0
+
+/* Timer overflow pending (overflow counter not updated yet) */
+#define TSYNC_OVF()	(TIFR1 & (1<<TOV1))
+
+/* Config nibble marking time sync frames (if control byte is compiled) */
+#define TSYNC_CONFIG	0x0E
+
+/** Flooding time synchronization */
+namespace TimeSync {
+	/** Frame body */
+	typedef struct {
+		uint8_t Root;		/**< Root known by sender */
+		uint8_t Src;		/**< Sender Id */
+		uint8_t Num;		/**< Sender frame counter */
+		uint8_t Seq;		/**< Round */
+		uint8_t PrevSeq;	/**< Round of previous frame */
+		uint32_t PrevTime;	/**< Global time at end of previous frame */
+	} __attribute__((packed)) msg_t;
+
+	/** Delay from RX stamp to TX stamp of the same frame */
+	const uint32_t Delay = (uint32_t)TSYNC_BYTE *
+		(Comm::PacketSize + sizeof(msg_t)) + TSYNC_FIX;
+
+	/** Time sync state */
+	static struct {
+		volatile uint16_t Overflows;
+
+		uint8_t Id, Root;
+		uint8_t Seq;		/* Newest round */
+		uint8_t LastSeq;	/* Round of the newest point */
+		uint8_t Heard;		/* Rounds since root frame */
+
+		/* Own previous frame */
+		uint8_t Num, PrevSeq;
+		uint32_t PrevTime;
+
+		/* Last frame from each neighbour */
+		struct {
+			uint8_t Src, Num;
+			uint32_t Local;
+		} Neigh[TSYNC_NEIGH];
+
+		/* Regression table */
+		uint32_t Local[TSYNC_POINTS];
+		int32_t Offset[TSYNC_POINTS];	/* Global - local */
+		uint8_t Count, Head;
+
+		/* Estimate */
+		uint32_t LocalAvg;
+		int32_t OffsetAvg;
+		float Skew;
+
+		msg_t Msg;
+		Comm::segment_t Seg;
+	} State;
+
+	/** Call from COMM_TICK timer overflow interrupt */
+	static inline void Overflow(void)
+	{
+		State.Overflows++;
+	}
+
+	/** 32 bit local clock */
+	static uint32_t Local(void)
+	{
+		const uint8_t SReg = SREG;
+		uint16_t High, Low;
+		cli();
+		High = State.Overflows;
+		Low = Comm::Tick();
+		if (TSYNC_OVF() && Low < 0x8000)
+			High++;
+		SREG = SReg;
+		return ((uint32_t)High << 16) | Low;
+	}
+
+	/** Extend 16 bit stamp taken less than one timer period ago */
+	static inline uint32_t Extend(uint16_t Stamp)
+	{
+		const uint32_t Now = Local();
+		uint32_t T = (Now & 0xFFFF0000UL) | Stamp;
+		if (T > Now)
+			T -= 0x10000UL;
+		return T;
+	}
+
+	/** Is the global time known */
+	static inline char Synced(void)
+	{
+		return State.Root == State.Id || State.Count >= TSYNC_MIN;
+	}
+
+	/** Convert local time to global */
+	static inline uint32_t Global(uint32_t Local)
+	{
+		if (State.Root == State.Id || State.Count == 0)
+			return Local;
+		return Local + State.OffsetAvg +
+			(int32_t)(State.Skew * (int32_t)(Local - State.LocalAvg));
+	}
+
+	/** Current global time */
+	static inline uint32_t Now(void)
+	{
+		return Global(Local());
+	}
+
+	/** Forget all points (root changed) */
+	static inline void Clear(void)
+	{
+		State.Count = State.Head = 0;
+	}
+
+	/** Start with no root known */
+	static inline void Init(uint8_t Id)
+	{
+		memset(&State, 0, sizeof(State));
+		State.Id = Id;
+		State.Root = 0xFF;
+	}
+
+	/** Estimate offset and skew from the table */
+	static void Regress(void)
+	{
+		const uint32_t L0 = State.Local[0];
+		const int32_t O0 = State.Offset[0];
+		int32_t SumL = 0, SumO = 0, dL, dO;
+		float Num = 0, Den = 0;
+		uint8_t i;
+
+		/* Averages relative to the first point - no overflow */
+		for (i = 0; i < State.Count; i++) {
+			SumL += (int32_t)(State.Local[i] - L0);
+			SumO += State.Offset[i] - O0;
+		}
+		State.LocalAvg = L0 + SumL / State.Count;
+		State.OffsetAvg = O0 + SumO / State.Count;
+
+		for (i = 0; i < State.Count; i++) {
+			dL = (int32_t)(State.Local[i] - State.LocalAvg);
+			dO = State.Offset[i] - State.OffsetAvg;
+			Num += (float)dL * dO;
+			Den += (float)dL * dL;
+		}
+		State.Skew = Den > 0 ? Num / Den : 0;
+	}
+
+	/** Add (local, global) pair */
+	static void Add(uint32_t Local, uint32_t Global)
+	{
+		State.Local[State.Head] = Local;
+		State.Offset[State.Head] = (int32_t)(Global - Local);
+		State.Head = (State.Head + 1) % TSYNC_POINTS;
+		if (State.Count < TSYNC_POINTS)
+			State.Count++;
+		Regress();
+	}
+
+	/**
+	 * \brief
+	 *   Handle time sync frame. Must be called before COMM_TICK
+	 *   wraps since the reception.
+	 *
+	 * \param Stamp
+	 *   Comm stamp of the frame (RXGetStamp() or packet Stamp)
+	 *
+	 * \return 1 if a new point was added.
+	 */
+	static char Received(const void *Mesg, Comm::len_t Length, uint16_t Stamp)
+	{
+		const msg_t *M = (const msg_t *)Mesg;
+		const uint32_t Local = Extend(Stamp);
+		char Added = 0;
+		uint8_t n;
+
+		if (Length != sizeof(msg_t) || M->Src == State.Id)
+			return 0;
+
+		if (M->Root > State.Root)
+			return 0; /* It will adopt our root */
+		if (M->Root < State.Root) {
+			State.Root = M->Root;
+			State.Seq = State.LastSeq = M->Seq;
+			Clear();
+		}
+		if ((int8_t)(M->Seq - State.Seq) > 0)
+			State.Seq = M->Seq;
+		State.Heard = 0;
+
+		/* Pair with previous frame of the sender; first report of
+		 * a round wins */
+		n = M->Src % TSYNC_NEIGH;
+		if (State.Neigh[n].Src == M->Src &&
+		    State.Neigh[n].Num == (uint8_t)(M->Num - 1) &&
+		    (int8_t)(M->PrevSeq - State.LastSeq) > 0) {
+			State.LastSeq = M->PrevSeq;
+			Add(State.Neigh[n].Local + Delay, M->PrevTime);
+			Added = 1;
+		}
+		State.Neigh[n].Src = M->Src;
+		State.Neigh[n].Num = M->Num;
+		State.Neigh[n].Local = Local;
+		return Added;
+	}
+
+	/** Call once per round period with Comm idle. Root starts
+	 * a new round, synchronized nodes pass the time further.
+	 * Blocks until the frame is sent. Returns 0 if not sent. */
+	static char Send(void)
+	{
+		if (State.Root != State.Id && ++State.Heard > TSYNC_ROOT_TIMEOUT) {
+			/* Root lost; take over */
+			State.Root = State.Id;
+			Clear();
+		}
+		if (State.Root == State.Id)
+			State.Seq++;
+		else if (State.Count < TSYNC_MIN)
+			return 0;
+
+		State.Msg.Root = State.Root;
+		State.Msg.Src = State.Id;
+		State.Msg.Num = State.Num;
+		State.Msg.Seq = State.Seq;
+		State.Msg.PrevSeq = State.PrevSeq;
+		State.Msg.PrevTime = State.PrevTime;
+
+		State.Seg.Data = &State.Msg;
+		State.Seg.Length = sizeof(msg_t);
+		State.Seg.Flags = Comm::SG_RAM;
+#if COMM1_CTR
+		Comm::TXSendConfig(&State.Seg, 1, TSYNC_CONFIG);
+#else
+		Comm::TXSend(&State.Seg, 1);
+#endif
+		Comm::TXWait();
+
+		/* Follow-up for the next frame */
+		State.Num++;
+		State.PrevSeq = State.Seq;
+		State.PrevTime = Global(Extend(Comm::TXGetEnd()));
+		return 1;
+	}
+}
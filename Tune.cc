@@ -0,0 +1,182 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Receiver auto-tuning (VDI response, clock recovery, AFC).
+ *
+ * Requires RF.cc and Comm.cc modules included (RX without RXPOOL, stats
+ * and CRC for receiver; TXSG for transmitter).
+ * Instead of reflashing with different RF12_RXCTL/RF12_FILTER/RF12_AFC
+ * one node runs Tune::Transmit() which sends numbered test frames
+ * back-to-back, while the other runs Tune::Run(). Receiver listens
+ * TUNE_WINDOW ms with each combination of settings and scores it by
+ * the number of correct test frames (PER) and synchronizations
+ * (any frame start - correct or not). Best set is applied and might be
+ * stored in EEPROM with Save() and restored at boot with Load().
+ *
+ * Example:
+ * if (!Tune::Load()) {
+ *	Tune::Run();
+ *	Tune::Save();
+ * }
+ ********************/
+
+#include <avr/eeprom.h>
+
+/***
+ * Tuning configuration
+ ***/
+
+/* Time of listening with each set of settings [ms] */
+#define TUNE_WINDOW	500
+
+/* Candidate settings. Every combination is tried. */
+#define TUNE_RXCTL							\
+	RF12_RXCTL_CMD(FAST, 134, 0, n103, RF12_VDI),			\
+	RF12_RXCTL_CMD(MEDIUM, 134, 0, n103, RF12_VDI),			\
+	RF12_RXCTL_CMD(SLOW, 134, 0, n103, RF12_VDI),			\
+	RF12_RXCTL_CMD(ALWAYS, 134, 0, n103, RF12_VDI)
+#define TUNE_FILTER							\
+	RF12_FILTER_CMD(3, RF12_CAL | RF12_DIG),			\
+	RF12_FILTER_CMD(4, RF12_CAL | RF12_DIG),			\
+	RF12_FILTER_CMD(4, RF12_CML | RF12_DIG),			\
+	RF12_FILTER_CMD(5, RF12_CAL | RF12_DIG)
+#define TUNE_AFC							\
+	RF12_AFC_CMD(ATRECV, NORESTR, RF12_OE | RF12_EN),		\
+	RF12_AFC_CMD(ATPWR, NORESTR, RF12_OE | RF12_EN),		\
+	RF12_AFC_CMD(INDEP, NORESTR, RF12_OE | RF12_EN)
+
+/* EEPROM record marker; change when record format changes */
+#define TUNE_MAGIC	0xA5
+
+/** Receiver auto-tuning */
+namespace Tune {
+	/** Candidate settings in flash */
+	static const uint16_t RXCtls[] PROGMEM = { TUNE_RXCTL };
+	static const uint16_t Filters[] PROGMEM = { TUNE_FILTER };
+	static const uint16_t AFCs[] PROGMEM = { TUNE_AFC };
+
+	/** Test frame body; followed by a 16 bit frame number */
+	static const char Magic[] PROGMEM = "TUNE";
+
+	/** Stored (and selected) settings */
+	typedef struct {
+		uint8_t Magic;
+		uint16_t RXCtl, Filter, AFC;
+	} record_t;
+
+	/** Record in EEPROM */
+	static record_t EERecord EEMEM;
+
+	/** Score of last Run() */
+	static struct {
+		record_t Best;
+		uint16_t Score;		/**< 2 * correct frames + synchronizations */
+		uint16_t Good;		/**< Correct test frames of best setting */
+	} State;
+
+#if COMM1_TXSG
+	/** Send Count test frames back-to-back */
+	static void Transmit(uint16_t Count)
+	{
+		Comm::segment_t Seg[2];
+		uint16_t i;
+
+		Seg[0].Data = Magic;
+		Seg[0].Length = sizeof(Magic) - 1;
+		Seg[0].Flags = Comm::SG_PGM;
+		Seg[1].Data = &i;
+		Seg[1].Length = sizeof(i);
+		Seg[1].Flags = Comm::SG_RAM;
+		for (i = 0; i < Count; i++) {
+			Comm::TXSend(Seg, 2);
+			Comm::TXWait();
+		}
+	}
+#endif /* TXSG */
+
+#if COMM1_RX && !COMM1_RXPOOL && COMM1_STATS_RX && COMM1_CRC
+	/** Listen TUNE_WINDOW ms with current settings; returns score */
+	static uint16_t Listen(uint16_t *Good)
+	{
+		Comm::stats_t S;
+		uint32_t Start;
+		uint16_t ms;
+		Comm::len_t Length;
+		char *Buff;
+
+		Comm::StatsGet(&S, 0);
+		Start = S.PacketsRX + S.LenErr + S.CtrErr + S.CRCErr;
+		*Good = 0;
+		Comm::RXInit();
+		for (ms = 0; ms < TUNE_WINDOW; ms++) {
+			_delay_ms(1);
+			if (Comm::State.Mode != Comm::MX)
+				continue;
+			Buff = Comm::RXGetPacket(&Length);
+			if (Length == sizeof(Magic) - 1 + sizeof(uint16_t) &&
+			    memcmp_P(Buff, Magic, sizeof(Magic) - 1) == 0)
+				(*Good)++;
+			Comm::RXInit();
+		}
+		Comm::Idle();
+		Comm::StatsGet(&S, 0);
+		return 2 * *Good + (uint16_t)(S.PacketsRX + S.LenErr +
+			S.CtrErr + S.CRCErr - Start);
+	}
+
+	/** Try all combinations of settings and apply the best one */
+	static void Run(void)
+	{
+		uint8_t r, f, a;
+		uint16_t Score, Good;
+		record_t Cur;
+
+		State.Score = 0;
+		State.Best.Magic = TUNE_MAGIC;
+		State.Best.RXCtl = RF::RXCtl;
+		State.Best.Filter = RF::Filter;
+		State.Best.AFC = RF::AFC;
+
+		for (r = 0; r < sizeof(RXCtls) / sizeof(*RXCtls); r++)
+		for (f = 0; f < sizeof(Filters) / sizeof(*Filters); f++)
+		for (a = 0; a < sizeof(AFCs) / sizeof(*AFCs); a++) {
+			Cur.RXCtl = pgm_read_word(&RXCtls[r]);
+			Cur.Filter = pgm_read_word(&Filters[f]);
+			Cur.AFC = pgm_read_word(&AFCs[a]);
+			RF::SetRX(Cur.RXCtl, Cur.Filter, Cur.AFC);
+			Score = Listen(&Good);
+			if (Score > State.Score) {
+				State.Score = Score;
+				State.Good = Good;
+				State.Best.RXCtl = Cur.RXCtl;
+				State.Best.Filter = Cur.Filter;
+				State.Best.AFC = Cur.AFC;
+			}
+		}
+		RF::SetRX(State.Best.RXCtl, State.Best.Filter, State.Best.AFC);
+	}
+#endif /* RX */
+
+	/** Store currently used receiver settings in EEPROM */
+	static inline void Save(void)
+	{
+		record_t R;
+		R.Magic = TUNE_MAGIC;
+		R.RXCtl = RF::RXCtl;
+		R.Filter = RF::Filter;
+		R.AFC = RF::AFC;
+		eeprom_update_block(&R, &EERecord, sizeof(R));
+	}
+
+	/** Apply settings from EEPROM; returns 0 if there are none */
+	static inline char Load(void)
+	{
+		record_t R;
+		eeprom_read_block(&R, &EERecord, sizeof(R));
+		if (R.Magic != TUNE_MAGIC)
+			return 0;
+		RF::SetRX(R.RXCtl, R.Filter, R.AFC);
+		return 1;
+	}
+}
@@ -0,0 +1,125 @@
+/***********************************
+ * (C) 2009 by Tomasz bla Fortuna <bla@thera.be>.
+ * License: GPLv3+ (See Docs/LICENSE)
+ *
+ * Desc: Crystal calibration from AFC offset of received frames.
+ *
+ * Requires RF.cc and Comm.cc (with COMM_QUALITY) modules included.
+ * AFC measures the offset of each frame again, which at high rates and
+ * without deviation restriction is slow and unreliable. Here AFC offset
+ * of correctly received frames is averaged and, when the average is
+ * over one step, a correction is added to the frequency (RF::FreqCorr).
+ * Once the correction is stable AFC range is restricted (XTAL_RESTR).
+ * Correction is kept in EEPROM so the node starts already centered.
+ *
+ * One node (For e.g. the gateway) should be the reference and don't run
+ * this, otherwise nodes would chase each other.
+ *
+ * AFC offset step equals frequency parameter step (2.5kHz on 433 band,
+ * 5kHz on 868, 7.5kHz on 915).
+ *
+ * Example:
+ * Xtal::Load();				// After Comm::Init()
+ * Xtal::Update(&Pkt->Quality);		// After each correct frame
+ * if (Xtal::Stable()) Xtal::Save();
+ ********************/
+
+#include <avr/eeprom.h>
+
+/***
+ * Crystal calibration configuration
+ ***/
+
+/* Averaging weight: new sample has weight 1/(2^XTAL_SHIFT) */
+#define XTAL_SHIFT	3
+
+/* Frames without correction change after which calibration is stable */
+#define XTAL_STABLE	32
+
+/* AFC range restriction used when calibration is stable (RF12_NORESTR
+ * to keep the full range) */
+#define XTAL_RESTR	RF12_RESTR2
+
+/* Largest correction allowed [steps] */
+#define XTAL_MAXCORR	60
+
+/** Crystal calibration */
+namespace Xtal {
+	/** Calibration state */
+	static struct {
+		int16_t Avg;		/**< Averaged offset * 2^XTAL_SHIFT */
+		uint8_t Steady;		/**< Frames since last change */
+	} State;
+
+	/** Correction in EEPROM stored + 0x80, so erased cell (0xFF)
+	 * reads as out of range and is treated as 0 */
+	static uint8_t EECorr EEMEM;
+
+	/** Apply correction and retune */
+	static inline void Apply(int8_t Corr)
+	{
+		RF::FreqCorr = Corr;
+		RF::SetFreq(RF::CurFreq);
+	}
+
+	/** Restrict AFC range (stable) or release it (calibrating) */
+	static inline void Restrict(uint16_t Restr)
+	{
+		const uint16_t AFC = (RF::AFC & ~RF12_RESTR3) | Restr;
+		if (AFC != RF::AFC)
+			RF::SetRX(RF::RXCtl, RF::Filter, AFC);
+	}
+
+	/** Is the correction stable */
+	static inline char Stable(void)
+	{
+		return State.Steady >= XTAL_STABLE;
+	}
+
+	/** Take AFC offset of a correctly received frame.
+	 * Must be called between frames; returns 1 if frequency changed. */
+	static char Update(const Comm::quality_t *Q)
+	{
+		int8_t Step;
+
+		State.Avg = State.Avg - (State.Avg >> XTAL_SHIFT) + Q->Offset;
+
+		/* Average over one step in either direction */
+		if (State.Avg >= (1 << XTAL_SHIFT))
+			Step = 1;
+		else if (State.Avg <= -(1 << XTAL_SHIFT))
+			Step = -1;
+		else
+			Step = 0;
+
+		if (Step == 0 || RF::FreqCorr + Step > XTAL_MAXCORR ||
+		    RF::FreqCorr + Step < -XTAL_MAXCORR) {
+			if (State.Steady < XTAL_STABLE && ++State.Steady == XTAL_STABLE)
+				Restrict(XTAL_RESTR);
+			return 0;
+		}
+
+		/* Received signal is higher - move our center up */
+		State.Avg = 0;
+		if (State.Steady >= XTAL_STABLE)
+			Restrict(RF12_NORESTR);
+		State.Steady = 0;
+		Apply(RF::FreqCorr + Step);
+		return 1;
+	}
+
+	/** Store correction in EEPROM (written only if changed) */
+	static inline void Save(void)
+	{
+		eeprom_update_byte(&EECorr, (uint8_t)(RF::FreqCorr + 0x80));
+	}
+
+	/** Apply correction from EEPROM */
+	static inline void Load(void)
+	{
+		int8_t Corr = (int8_t)(eeprom_read_byte(&EECorr) - 0x80);
+		if (Corr > XTAL_MAXCORR || Corr < -XTAL_MAXCORR)
+			Corr = 0;
+		Apply(Corr);
+	}
+}